@@ -0,0 +1,41 @@
+#version 330 core
+
+// input data : one quad per part of the composite mesh
+layout (location = 0) in vec2 partCenter; // center of the part, relative to the mesh origin
+layout (location = 1) in vec3 partColor;
+layout (location = 2) in vec2 partCorner; // quad corner in [-1,1]
+layout (location = 5) in vec4 partShape; // radius, sides, rotation, damage needed to show the part
+
+// per instance data : advances once per instance
+layout (location = 3) in vec2 instanceTranslate;
+layout (location = 4) in float instanceDamage;
+
+// camera : shared by every program, updated once per frame
+layout (std140) uniform Camera
+{
+    mat4 VP;
+};
+
+// output data : same as SDFShape.vert, shaded by SDFShape.frag
+out vec2 fragLocal;
+flat out float fragRadius;
+flat out vec2 fragSidesRotation;
+flat out vec3 fragColor;
+
+void main ()
+{
+    // Grow the quad a little past the radius so the anti-aliased edge is not clipped
+    vec2 local = partCorner * (partShape.x + 2.0);
+
+    fragLocal = local;
+    fragRadius = partShape.x;
+    fragSidesRotation = partShape.yz;
+    fragColor = partColor;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * vec4(instanceTranslate + partCenter + local, 0, 1);
+
+    // Parts this instance is not damaged enough for collapse to a point and produce no fragments
+    if (instanceDamage < partShape.w)
+        gl_Position = vec4(0, 0, 0, 1);
+}
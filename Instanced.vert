@@ -0,0 +1,30 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition;
+
+// per instance data : advances once per instance
+layout (location = 3) in vec2 instanceTranslate;
+layout (location = 4) in float instanceScale;
+layout (location = 5) in vec3 instanceColor;
+
+// camera : shared by every program, updated once per frame
+layout (std140) uniform Camera
+{
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Scale the unit mesh and move it to this instance's position
+    vec4 v = vec4(vertexPosition*instanceScale + vec3(instanceTranslate, 0), 1);
+
+    // Every vertex of an instance shares the instance color
+    fragColor = instanceColor;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * v;
+}
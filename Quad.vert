@@ -0,0 +1,31 @@
+#version 330 core
+
+// per instance data : advances once per quad, there are no per vertex attributes
+layout (location = 3) in vec2 quadTranslate; // corner the quad grows from
+layout (location = 4) in vec2 quadSize;
+layout (location = 5) in float quadRotation; // radians, about quadTranslate
+layout (location = 6) in vec4 quadColor;
+
+// camera : shared by every program, updated once per frame
+layout (std140) uniform Camera
+{
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Triangle strip corners from the vertex number : (0,0) (1,0) (0,1) (1,1)
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    vec2 local = corner * quadSize;
+
+    float c = cos(quadRotation), s = sin(quadRotation);
+    vec2 world = quadTranslate + vec2(c*local.x - s*local.y, s*local.x + c*local.y);
+
+    fragColor = quadColor.rgb;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * vec4(world, 0, 1);
+}
@@ -0,0 +1,39 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 fragLocal;
+flat in float fragRadius;
+flat in vec2 fragSidesRotation;
+flat in vec3 fragColor;
+
+// output data
+out vec4 color;
+
+// Signed distance to a circle (sides < 3) or a regular polygon with circumradius r
+float shapeDistance(vec2 p, float r, float sides, float rotation)
+{
+    if (sides < 3.0)
+        return length(p) - r;
+
+    // Rotate so that the first vertex lies on the +x axis
+    float c = cos(rotation), s = sin(rotation);
+    p = mat2(c, -s, s, c) * p;
+
+    // Fold into one edge and measure along its normal
+    float half_angle = 3.14159265 / sides;
+    float b = mod(atan(p.y, p.x), 2.0*half_angle) - half_angle;
+    return length(p)*cos(b) - r*cos(half_angle);
+}
+
+void main()
+{
+    float d = shapeDistance(fragLocal, fragRadius, fragSidesRotation.x, fragSidesRotation.y);
+
+    // Analytic anti-aliasing: cover one screen pixel across the edge at any zoom
+    float w = fwidth(d);
+    float alpha = clamp(0.5 - d/w, 0.0, 1.0);
+    if (alpha <= 0.0)
+        discard;
+
+    color = vec4(fragColor, alpha);
+}
@@ -0,0 +1,36 @@
+#version 330 core
+
+// input data : sent from main program
+layout (location = 0) in vec3 vertexPosition; // unit quad corner in [-1,1]
+
+// per shape data : advances once per shape
+layout (location = 3) in vec2 shapeCenter;
+layout (location = 4) in float shapeRadius;
+layout (location = 5) in vec3 shapeColor;
+layout (location = 6) in vec2 shapeSidesRotation;
+
+// camera : shared by every program, updated once per frame
+layout (std140) uniform Camera
+{
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec2 fragLocal;
+flat out float fragRadius;
+flat out vec2 fragSidesRotation;
+flat out vec3 fragColor;
+
+void main ()
+{
+    // Grow the quad a little past the radius so the anti-aliased edge is not clipped
+    vec2 local = vertexPosition.xy * (shapeRadius + 2.0);
+
+    fragLocal = local;
+    fragRadius = shapeRadius;
+    fragSidesRotation = shapeSidesRotation;
+    fragColor = shapeColor;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * vec4(shapeCenter + local, 0, 1);
+}
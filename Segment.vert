@@ -0,0 +1,47 @@
+#version 330 core
+
+// per instance data : one digit, there are no per vertex attributes
+layout (location = 3) in vec2 digitTranslate; // top left corner of the digit
+layout (location = 4) in uint digitSegments; // bit i lights segment i
+layout (location = 5) in vec4 digitColor;
+
+// camera : shared by every program, updated once per frame
+layout (std140) uniform Camera
+{
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+// Corner and size of each segment relative to digitTranslate : top, top right, bottom right, bottom, bottom left, top left, middle
+const vec4 segments[7] = vec4[7](
+    vec4(0, 0, 18, 4),
+    vec4(15, -15, 4, 18),
+    vec4(15, -30, 4, 18),
+    vec4(0, -30, 18, 4),
+    vec4(0, -30, 4, 18),
+    vec4(0, -15, 4, 18),
+    vec4(0, -15, 18, 4)
+);
+
+// Two triangles per segment
+const vec2 corners[6] = vec2[6](vec2(0,0), vec2(1,0), vec2(1,1), vec2(0,0), vec2(0,1), vec2(1,1));
+
+void main ()
+{
+    int segment = gl_VertexID / 6;
+    fragColor = digitColor.rgb;
+
+    // Unlit segments collapse to a point and produce no fragments
+    if ((digitSegments & (1u << uint(segment))) == 0u) {
+        gl_Position = vec4(0, 0, 0, 1);
+        return;
+    }
+
+    vec4 rect = segments[segment];
+    vec2 world = digitTranslate + rect.xy + corners[gl_VertexID % 6] * rect.zw;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * vec4(world, 0, 1);
+}
@@ -4,7 +4,7 @@
 in vec2 fragTexCoord;
 
 // output data
-out vec3 color;
+out vec4 color;
 
 // Texture sample for the whole mesh
 uniform sampler2D texSampler;
@@ -13,5 +13,5 @@ void main()
 {
     // Output color = color from texture sample specified in the vertex shader,
     // interpolated between all 3 surrounding vertices of the triangle
-    color = texture( texSampler, fragTexCoord ).rgb;
+    color = texture( texSampler, fragTexCoord );
 }
\ No newline at end of file
@@ -4,19 +4,24 @@
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 2) in vec2 vertexTexCoord;
 
-uniform mat4 MVP;
+// camera : shared by every program, updated once per frame
+layout (std140) uniform Camera
+{
+    mat4 VP;
+};
+uniform mat3 Model; // 2D model transform
 
 // output data : used by fragment shader
 out vec2 fragTexCoord;
 
 void main ()
 {
-    vec4 v = vec4(vertexPosition, 1); // Transform an homogeneous 4D vector
+    vec3 world = Model * vec3(vertexPosition.xy, 1); // Model transform in the XY plane
 
     // The texture coord of each vertex will be interpolated
     // to produce the color of each fragment
     fragTexCoord = vertexTexCoord;
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Output position of the vertex, in clip space : VP * Model * position
+    gl_Position = VP * vec4(world.xy, vertexPosition.z, 1);
 }
\ No newline at end of file
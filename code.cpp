@@ -2,6 +2,26 @@
 #include <cmath>
 #include <fstream>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <cstddef>
+#include <cstring>
+#include <cfloat>
+#include <climits>
+#include <cstdio>
+#include <iterator>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -9,116 +29,806 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <glad/glad.h>
-#include <FTGL/ftgl.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
 #include <GLFW/glfw3.h>
 #include <SOIL/SOIL.h>
 
 using namespace std;
 
+/* GL state cache - mirrors the bindings we set so that calls which would change nothing are skipped */
+struct GLStateCache {
+	GLuint Program;
+	GLuint VertexArray;
+	GLuint ArrayBuffer;
+	GLuint Texture; // GL_TEXTURE_2D on the active unit
+	GLenum PolygonMode;
+	std::map<GLuint, unsigned> EnabledAttribs; // Bitmask of enabled attributes, per VAO
+	std::map<std::pair<GLuint, GLint>, glm::mat3> Matrices; // Last 2D model matrix uploaded, per (program, location)
+
+	unsigned Issued, Elided; // Calls passed on / skipped in the current frame
+	unsigned LastIssued, LastElided; // Same for the previous frame
+} GLState;
+
+/* Forget the cached bindings - use after code we do not control touched the GL state */
+void glsInvalidate ()
+{
+	GLState.Program = GLState.VertexArray = GLState.ArrayBuffer = GLState.Texture = ~0u;
+	GLState.PolygonMode = GL_NONE;
+	GLState.EnabledAttribs.clear();
+	GLState.Matrices.clear();
+}
+
+/* Start counting calls for a new frame */
+void glsBeginFrame ()
+{
+	GLState.LastIssued = GLState.Issued;
+	GLState.LastElided = GLState.Elided;
+	GLState.Issued = GLState.Elided = 0;
+}
+
+static bool glsChanged (GLuint& cached, GLuint value)
+{
+	if (cached == value) {
+		GLState.Elided++;
+		return false;
+	}
+	GLState.Issued++;
+	cached = value;
+	return true;
+}
+
+void glsUseProgram (GLuint program)
+{
+	if (glsChanged(GLState.Program, program))
+		glUseProgram(program);
+}
+
+void glsBindVertexArray (GLuint vao)
+{
+	if (glsChanged(GLState.VertexArray, vao))
+		glBindVertexArray(vao);
+}
+
+/* Only GL_ARRAY_BUFFER is cached, other targets are passed straight through */
+void glsBindBuffer (GLenum target, GLuint buffer)
+{
+	if (target != GL_ARRAY_BUFFER) {
+		GLState.Issued++;
+		glBindBuffer(target, buffer);
+	}
+	else if (glsChanged(GLState.ArrayBuffer, buffer))
+		glBindBuffer(target, buffer);
+}
+
+void glsBindTexture (GLuint texture)
+{
+	if (glsChanged(GLState.Texture, texture))
+		glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void glsPolygonMode (GLenum mode)
+{
+	if (glsChanged(GLState.PolygonMode, mode))
+		glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+/* Attribute enables belong to the bound VAO */
+void glsEnableVertexAttribArray (GLuint index)
+{
+	unsigned& enabled = GLState.EnabledAttribs[GLState.VertexArray];
+	if (enabled & (1u << index)) {
+		GLState.Elided++;
+		return;
+	}
+	GLState.Issued++;
+	enabled |= 1u << index;
+	glEnableVertexAttribArray(index);
+}
+
+/* Upload a matrix uniform of the program in use unless it already holds this value */
+void glsUniformMatrix3fv (GLint location, const glm::mat3& matrix)
+{
+	std::pair<GLuint, GLint> key(GLState.Program, location);
+	std::map<std::pair<GLuint, GLint>, glm::mat3>::iterator it = GLState.Matrices.find(key);
+	if (it != GLState.Matrices.end() && it->second == matrix) {
+		GLState.Elided++;
+		return;
+	}
+	GLState.Issued++;
+	GLState.Matrices[key] = matrix;
+	glUniformMatrix3fv(location, 1, GL_FALSE, &matrix[0][0]);
+}
+
+/* Owning handles for GL objects - the object is deleted when its handle is destroyed or reset */
+struct BufferTraits {
+	static void destroy (GLuint id) {
+		if (GLState.ArrayBuffer == id)
+			GLState.ArrayBuffer = 0; // Deleting a bound object reverts the binding to 0
+		glDeleteBuffers(1, &id);
+	}
+};
+struct VertexArrayTraits {
+	static void destroy (GLuint id) {
+		if (GLState.VertexArray == id)
+			GLState.VertexArray = 0;
+		GLState.EnabledAttribs.erase(id); // The name may be reused by a new VAO
+		glDeleteVertexArrays(1, &id);
+	}
+};
+struct TextureTraits {
+	static void destroy (GLuint id) {
+		if (GLState.Texture == id)
+			GLState.Texture = 0;
+		glDeleteTextures(1, &id);
+	}
+};
+struct FramebufferTraits { static void destroy (GLuint id) { glDeleteFramebuffers(1, &id); } };
+struct RenderbufferTraits { static void destroy (GLuint id) { glDeleteRenderbuffers(1, &id); } };
+struct ProgramTraits {
+	static void destroy (GLuint id) {
+		if (GLState.Program == id)
+			GLState.Program = 0;
+		// A later program may get the same name - its uniforms must not look uploaded already
+		GLState.Matrices.erase(GLState.Matrices.lower_bound(std::make_pair(id, INT_MIN)),
+							   GLState.Matrices.upper_bound(std::make_pair(id, INT_MAX)));
+		glDeleteProgram(id);
+	}
+};
+
+template <class Traits>
+class GLHandle {
+public:
+	GLHandle () : id(0) {}
+	explicit GLHandle (GLuint id) : id(id) {}
+	~GLHandle () { reset(); }
+
+	// Move only - exactly one handle owns a GL object
+	GLHandle (GLHandle&& other) : id(other.id) { other.id = 0; }
+	GLHandle& operator= (GLHandle&& other) {
+		if (this != &other) {
+			reset(other.id);
+			other.id = 0;
+		}
+		return *this;
+	}
+	GLHandle (const GLHandle&) = delete;
+	GLHandle& operator= (const GLHandle&) = delete;
+
+	operator GLuint () const { return id; }
+
+	// Delete the owned object (if any) and take ownership of newId
+	void reset (GLuint newId = 0) {
+		if (id != 0)
+			Traits::destroy(id);
+		id = newId;
+	}
+
+private:
+	GLuint id;
+};
+typedef GLHandle<BufferTraits> GLBuffer;
+typedef GLHandle<VertexArrayTraits> GLVertexArray;
+typedef GLHandle<TextureTraits> GLTexture;
+typedef GLHandle<FramebufferTraits> GLFramebuffer;
+typedef GLHandle<RenderbufferTraits> GLRenderbuffer;
+typedef GLHandle<ProgramTraits> GLProgram;
+
+GLBuffer genBuffer () { GLuint id; glGenBuffers(1, &id); return GLBuffer(id); }
+GLVertexArray genVertexArray () { GLuint id; glGenVertexArrays(1, &id); return GLVertexArray(id); }
+GLTexture genTexture () { GLuint id; glGenTextures(1, &id); return GLTexture(id); }
+GLFramebuffer genFramebuffer () { GLuint id; glGenFramebuffers(1, &id); return GLFramebuffer(id); }
+GLRenderbuffer genRenderbuffer () { GLuint id; glGenRenderbuffers(1, &id); return GLRenderbuffer(id); }
+
+/* Normalized 8-bit RGBA color, as stored in vertex and instance streams */
+struct PackedColor {
+	GLubyte R, G, B, A;
+};
+
+PackedColor packColor (GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.0f)
+{
+	PackedColor color = { (GLubyte)(r*255.0f + 0.5f), (GLubyte)(g*255.0f + 0.5f), (GLubyte)(b*255.0f + 0.5f), (GLubyte)(a*255.0f + 0.5f) };
+	return color;
+}
+
+bool operator== (const PackedColor& a, const PackedColor& b)
+{
+	return a.R == b.R && a.G == b.G && a.B == b.B && a.A == b.A;
+}
+
+/* Vertex layouts of the geometry pools - every mesh lies in the XY plane, so positions are 2D */
+struct ColorVertex {
+	GLfloat Position[2];
+	PackedColor Color;
+};
+struct FlatVertex {
+	GLfloat Position[2];
+};
+struct TexturedVertex {
+	GLfloat Position[2];
+	GLfloat TexCoord[2];
+};
+struct TextVertex {
+	GLfloat Position[2];
+	GLfloat TexCoord[2];
+	PackedColor Color;
+};
+
+/* Handle to a mesh stored in one of the geometry pools */
 struct VAO {
-	GLuint VertexArrayID;
-	GLuint VertexBuffer;
-	GLuint ColorBuffer;
-	GLuint TextureBuffer;
+	GLuint VertexArrayID; // Shared VAO of the pool's vertex format
 	GLuint TextureID;
 
 	GLenum PrimitiveMode; // GL_POINTS, GL_LINE_STRIP, GL_LINE_LOOP, GL_LINES, GL_LINE_STRIP_ADJACENCY, GL_LINES_ADJACENCY, GL_TRIANGLE_STRIP, GL_TRIANGLE_FAN, GL_TRIANGLES, GL_TRIANGLE_STRIP_ADJACENCY and GL_TRIANGLES_ADJACENCY
 	GLenum FillMode; // GL_FILL, GL_LINE
+	int FirstVertex; // Offset of the mesh inside the pool, in vertices
 	int NumVertices;
+	GLuint MeshIndex; // Creation order of the mesh, the mesh field of render queue sort keys
+
+	std::vector<GLfloat> Vertices; // CPU copy of the positions (x,y), used by the sprite batcher
+	std::vector<PackedColor> Colors; // CPU copy of the colors, used by the sprite batcher - empty for flat color meshes
+	PackedColor FlatColor; // Color of every vertex of a flat color mesh
+	bool IsQuad; // Procedural quad built by the quad shader - no pool storage, only QuadSize and FlatColor
+	GLfloat QuadSize[2];
+	GLfloat Bounds[4]; // Bounding box in mesh space (min x, min y, max x, max y), for culling
 };
+
+/* Empty the bounding box, then grow it to contain a point */
+void resetBounds (GLfloat bounds[4])
+{
+	bounds[0] = bounds[1] = FLT_MAX;
+	bounds[2] = bounds[3] = -FLT_MAX;
+}
+void growBounds (GLfloat bounds[4], GLfloat x, GLfloat y)
+{
+	bounds[0] = std::min(bounds[0], x);
+	bounds[1] = std::min(bounds[1], y);
+	bounds[2] = std::max(bounds[2], x);
+	bounds[3] = std::max(bounds[3], y);
+}
 typedef struct VAO VAO;
 
+/* Per instance data for instanced meshes - unit mesh is scaled, moved and colored by this */
+struct Instance {
+	GLfloat Translate[2];
+	GLfloat Scale;
+	PackedColor Color;
+};
+
+/* Per instance data for the SDF shader - circles and regular polygons drawn as one quad each */
+struct ShapeInstance {
+	GLfloat Center[2];
+	GLfloat Radius; // Circumradius for polygons
+	PackedColor Color;
+	GLfloat Sides; // 0 for a circle
+	GLfloat Rotation; // Angle of the first polygon vertex, in radians
+};
+
+/* One SDF shape of a composite mesh - shown only on instances damaged at least Threshold */
+struct ShapePart {
+	GLfloat Center[2]; // Relative to the mesh origin
+	GLfloat Radius;
+	GLfloat Color[3];
+	GLfloat Sides; // 0 for a circle
+	GLfloat Rotation;
+	GLfloat Threshold;
+};
+
+/* Per instance data for composite meshes */
+struct CompositeInstance {
+	GLfloat Translate[2];
+	GLfloat Damage; // Compared against the Threshold of every part
+};
+
+/* Per instance data for the quad shader - corners come from gl_VertexID, so this is all a quad needs */
+struct QuadInstance {
+	GLfloat Translate[2];
+	GLfloat Size[2];
+	GLfloat Rotation; // radians
+	PackedColor Color;
+};
+
+/* Per instance data for the seven-segment shader - one digit, segment geometry is in the shader */
+struct DigitInstance {
+	GLfloat Translate[2];
+	GLuint Segments; // bit i lights segment i
+	PackedColor Color;
+};
+
+/* Segments lit for each decimal digit : top, top right, bottom right, bottom, bottom left, top left, middle */
+constexpr GLuint segmentMask (int top, int top_right, int bottom_right, int bottom, int bottom_left, int top_left, int middle)
+{
+	return top | top_right << 1 | bottom_right << 2 | bottom << 3 | bottom_left << 4 | top_left << 5 | middle << 6;
+}
+constexpr GLuint DIGIT_SEGMENTS[10] = {
+	segmentMask(1,1,1,1,1,1,0),
+	segmentMask(0,1,1,0,0,0,0),
+	segmentMask(1,1,0,1,1,0,1),
+	segmentMask(1,1,1,1,0,0,1),
+	segmentMask(0,1,1,0,0,1,1),
+	segmentMask(1,0,1,1,0,1,1),
+	segmentMask(1,0,1,1,1,1,1),
+	segmentMask(1,1,1,0,0,0,0),
+	segmentMask(1,1,1,1,1,1,1),
+	segmentMask(1,1,1,1,0,1,1)
+};
+static_assert(DIGIT_SEGMENTS[8] == 0x7F, "every segment of an 8 is lit");
+
+/* Static meshes of one vertex format, suballocated from a single large VBO */
+struct GeometryPool {
+	GLBuffer VertexBuffer;
+	GLsizei Stride; // bytes per vertex
+	GLint Capacity; // vertices the VBO can hold
+	GLint Used; // vertices handed out so far
+	void (*BindFormat) (); // Points the shared VAOs of this format at VertexBuffer
+};
+
+struct GeometryPools {
+	GeometryPool Color; // ColorVertex - position (x,y) + RGBA8 color
+	GeometryPool Flat; // FlatVertex - position (x,y), the color comes from a constant attribute or the instance
+	GeometryPool Textured; // TexturedVertex - position (x,y) + texture coordinates (s,t)
+	GeometryPool Composite; // part center (x,y) + color (r,g,b) + quad corner (x,y) + part (radius,sides,rotation,threshold)
+
+	// Shared VAOs - one per vertex format, all drawn without touching buffer bindings
+	GLVertexArray ColorVAO; // Color pool
+	GLVertexArray FlatVAO; // Flat pool
+	GLVertexArray TexturedVAO; // Textured pool
+	GLVertexArray InstancedVAO; // Flat pool + instances in the stream buffer
+	GLVertexArray ShapeVAO; // Flat pool + shapes in the stream buffer
+	GLVertexArray CompositeVAO; // Composite pool + instances in the stream buffer
+	GLVertexArray QuadVAO; // Quads in the stream buffer only
+	GLVertexArray TextVAO; // Glyph quads in the stream buffer
+	GLVertexArray DigitVAO; // Seven-segment digits in the stream buffer only
+
+} Geometry;
+
 struct GLMatrices {
 	glm::mat4 projection;
-	glm::mat4 model;
+	glm::mat3 model; // 2D model transform
 	glm::mat4 view;
+	glm::mat4 VP; // projection * view, computed once per camera change
+	GLBuffer CameraBuffer; // UBO - "Camera" block shared by every program
 	GLuint MatrixID; // For use with normal shader
 	GLuint TexMatrixID; // For use with texture shader
 } Matrices;
 
-struct FTGLFont {
-	FTFont* font;
-	GLuint fontMatrixID;
-	GLuint fontColorID;
-} GL3Font;
+/* Binding point of the "Camera" uniform block in every program */
+const GLuint CAMERA_BLOCK_BINDING = 0;
+
+/* Create the camera UBO and attach it to its binding point */
+void initCamera ()
+{
+	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+	Matrices.CameraBuffer = genBuffer();
+	glBindBuffer (GL_UNIFORM_BUFFER, Matrices.CameraBuffer);
+	glBufferData (GL_UNIFORM_BUFFER, sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase (GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, Matrices.CameraBuffer);
+}
+
+/* Recompute VP from the current projection and upload it if it changed */
+void updateCamera ()
+{
+	glm::mat4 VP = Matrices.projection * Matrices.view;
+	if (VP == Matrices.VP)
+		return;
+	Matrices.VP = VP;
+	glBindBuffer (GL_UNIFORM_BUFFER, Matrices.CameraBuffer);
+	glBufferSubData (GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), &VP[0][0]);
+}
+
+/* Connect the program's "Camera" block to the shared camera UBO */
+void bindCameraBlock (GLuint program)
+{
+	GLuint index = glGetUniformBlockIndex(program, "Camera");
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, index, CAMERA_BLOCK_BINDING);
+}
+
+/* 2D model transform - scale, then rotate about z by angle (radians), then translate */
+glm::mat3 model2D (glm::vec2 trans, float angle, glm::vec2 scale)
+{
+	float c = cos(angle), s = sin(angle);
+	return glm::mat3(c*scale.x, s*scale.x, 0,
+					 -s*scale.y, c*scale.y, 0,
+					 trans.x, trans.y, 1);
+}
+
+/* Printable ASCII glyphs of one font, rasterized once into a single texture */
+const int FIRST_GLYPH = 32, LAST_GLYPH = 126;
+struct Glyph {
+	GLfloat Advance; // Pen advance, in atlas pixels
+	GLfloat Bearing[2]; // Bottom left corner of the bitmap relative to the pen, in atlas pixels
+	GLfloat Size[2]; // Bitmap size, in atlas pixels
+	GLfloat UV[4]; // Atlas rectangle (s0,t0,s1,t1) - t0 is the top row of the bitmap
+};
+struct GlyphAtlas {
+	GLTexture Texture; // GL_R8 coverage
+	GLfloat PixelSize; // Em size the glyphs were rasterized at
+	Glyph Glyphs[LAST_GLYPH - FIRST_GLYPH + 1];
+} Font;
+
+GLProgram programID, fontProgramID, textureProgramID, instancedProgramID, shapeProgramID, compositeProgramID, quadProgramID, segmentProgramID;
+GLTexture beach_texture;
+
+/* Linked program binaries are cached on disk, keyed by the shader sources and the driver that built them */
+const char* PROGRAM_CACHE_DIR = "shader_cache";
+const GLuint PROGRAM_CACHE_MAGIC = 0x43505347; // "GSPC"
+struct ProgramCacheHeader {
+	GLuint Magic;
+	GLenum Format; // from glGetProgramBinary
+	unsigned long long Key; // guards against a renamed file
+	GLint Length; // bytes of binary after the header, guards against a truncated file
+};
+
+/* 64 bit FNV-1a, continued from hash */
+unsigned long long fnv1a (const std::string& data, unsigned long long hash = 14695981039346656037ULL)
+{
+	for (size_t i = 0; i < data.size(); i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// True if the driver can hand out program binaries at all
+bool programCacheSupported ()
+{
+	if (!GLAD_GL_ARB_get_program_binary)
+		return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+/* Key of a program - a driver update or a different GPU changes it, so stale binaries are never loaded */
+unsigned long long programCacheKey (const std::string& vertex_code, const std::string& fragment_code)
+{
+	unsigned long long key = fnv1a(vertex_code);
+	key = fnv1a(std::string(1, '\0') + fragment_code, key);
+	const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for (int i = 0; i < 3; i++)
+		key = fnv1a(std::string(1, '\0') + (const char*)glGetString(strings[i]), key);
+	return key;
+}
+
+std::string programCachePath (unsigned long long key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.bin", key);
+	return PROGRAM_CACHE_DIR + std::string(name);
+}
 
-GLuint programID, fontProgramID, textureProgramID;
+/* Program from the cached binary, or 0 if there is none or the driver rejects it */
+GLuint loadProgramBinary (unsigned long long key)
+{
+	std::ifstream file(programCachePath(key).c_str(), std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return 0;
+
+	ProgramCacheHeader header;
+	if (!file.read((char*)&header, sizeof(header)) || header.Magic != PROGRAM_CACHE_MAGIC || header.Key != key)
+		return 0;
+	std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (binary.empty() || binary.size() != (size_t)header.Length)
+		return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.Format, &binary[0], binary.size());
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE) {
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	return ProgramID;
+}
+
+/* Write the binary of a linked program to the cache - failures only cost the next start a compile */
+void saveProgramBinary (unsigned long long key, GLuint ProgramID)
+{
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+	std::vector<char> binary(length);
+	ProgramCacheHeader header = { PROGRAM_CACHE_MAGIC, 0, key, 0 };
+	glGetProgramBinary(ProgramID, length, &header.Length, &header.Format, &binary[0]);
+
+	// Write to a temporary file and rename, so a cut off write never replaces a good entry
+	mkdir(PROGRAM_CACHE_DIR, 0755);
+	std::string path = programCachePath(key), temp = path + ".tmp";
+	{
+		std::ofstream file(temp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return;
+		file.write((const char*)&header, sizeof(header));
+		file.write(&binary[0], header.Length);
+		if (!file.good()) {
+			file.close();
+			remove(temp.c_str());
+			return;
+		}
+	}
+	if (rename(temp.c_str(), path.c_str()) != 0)
+		remove(temp.c_str());
+}
+
+/* Whole file in one read */
+std::string readShaderFile (const char* path)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		cout << "Error: cannot open shader " << path << '\n';
+		return std::string();
+	}
+	return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+/* One program of a batch - compiles and links of the whole batch are in flight before any status is read */
+struct ShaderProgramLoad {
+	const char* VertexPath;
+	const char* FragmentPath;
+	GLProgram* Program; // receives the linked program, may be NULL
+	// Filled in by the batch
+	GLuint VertexShaderID, FragmentShaderID, ProgramID;
+	unsigned long long CacheKey;
+	bool Cached;
+};
+
+void printShaderLog (GLuint id, bool program)
+{
+	GLint InfoLogLength = 0;
+	if (program)
+		glGetProgramiv(id, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	else
+		glGetShaderiv(id, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if (InfoLogLength <= 1)
+		return;
+	std::vector<char> ErrorMessage(InfoLogLength);
+	if (program)
+		glGetProgramInfoLog(id, InfoLogLength, NULL, &ErrorMessage[0]);
+	else
+		glGetShaderInfoLog(id, InfoLogLength, NULL, &ErrorMessage[0]);
+	cout << ErrorMessage.data() << '\n';
+}
+
+/* Start compiling and linking every program - nothing here waits for the compiler */
+void beginShaderPrograms (ShaderProgramLoad* loads, int count)
+{
+	// Let the driver compile on its own threads when it can
+	if (GLAD_GL_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+	bool CacheSupported = programCacheSupported();
+
+	for (int i = 0; i < count; i++) {
+		ShaderProgramLoad& load = loads[i];
+		std::string VertexShaderCode = readShaderFile(load.VertexPath);
+		std::string FragmentShaderCode = readShaderFile(load.FragmentPath);
+		load.VertexShaderID = load.FragmentShaderID = 0;
+		load.Cached = false;
+
+		// Reuse the binary linked by an earlier run of the same sources on the same driver
+		load.CacheKey = CacheSupported ? programCacheKey(VertexShaderCode, FragmentShaderCode) : 0;
+		load.ProgramID = CacheSupported ? loadProgramBinary(load.CacheKey) : 0;
+		if (load.ProgramID) {
+			load.Cached = true;
+			continue;
+		}
+
+		cout << "Compiling shaders : " << load.VertexPath << ", " << load.FragmentPath << '\n';
+		load.VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+		char const * VertexSourcePointer = VertexShaderCode.c_str();
+		glShaderSource(load.VertexShaderID, 1, &VertexSourcePointer , NULL);
+		glCompileShader(load.VertexShaderID);
+
+		load.FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+		char const * FragmentSourcePointer = FragmentShaderCode.c_str();
+		glShaderSource(load.FragmentShaderID, 1, &FragmentSourcePointer , NULL);
+		glCompileShader(load.FragmentShaderID);
+	}
+
+	// Linking a shader that failed to compile just fails the link, so no status is needed yet
+	for (int i = 0; i < count; i++) {
+		ShaderProgramLoad& load = loads[i];
+		if (load.Cached)
+			continue;
+		load.ProgramID = glCreateProgram();
+		glAttachShader(load.ProgramID, load.VertexShaderID);
+		glAttachShader(load.ProgramID, load.FragmentShaderID);
+		if (CacheSupported)
+			glProgramParameteri(load.ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(load.ProgramID);
+	}
+}
+
+/* Wait for the batch, print logs, cache new binaries and hand out the programs that linked - false if any failed */
+bool finishShaderPrograms (ShaderProgramLoad* loads, int count)
+{
+	bool ok = true;
+	for (int i = 0; i < count; i++) {
+		ShaderProgramLoad& load = loads[i];
+		if (load.Cached)
+			cout << "Loaded cached program : " << load.VertexPath << ", " << load.FragmentPath << '\n';
+		else {
+			GLint Result = GL_FALSE;
+			glGetProgramiv(load.ProgramID, GL_LINK_STATUS, &Result);
+			printShaderLog(load.VertexShaderID, false);
+			printShaderLog(load.FragmentShaderID, false);
+			printShaderLog(load.ProgramID, true);
+			glDetachShader(load.ProgramID, load.VertexShaderID);
+			glDetachShader(load.ProgramID, load.FragmentShaderID);
+			glDeleteShader(load.VertexShaderID);
+			glDeleteShader(load.FragmentShaderID);
+			load.VertexShaderID = load.FragmentShaderID = 0;
+
+			if (Result == GL_TRUE) {
+				if (load.CacheKey)
+					saveProgramBinary(load.CacheKey, load.ProgramID);
+			}
+			else {
+				cout << "Error: linking " << load.VertexPath << ", " << load.FragmentPath << " failed" << '\n';
+				glDeleteProgram(load.ProgramID);
+				load.ProgramID = 0;
+				ok = false;
+				continue; // Program keeps what it had
+			}
+		}
+		if (load.Program)
+			load.Program->reset(load.ProgramID);
+	}
+	return ok;
+}
 
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+	ShaderProgramLoad load = { vertex_file_path, fragment_file_path, NULL };
+	beginShaderPrograms(&load, 1);
+	finishShaderPrograms(&load, 1);
+	return load.ProgramID;
+}
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+/* Every program of the game, in the order they are compiled - the shader watcher relinks entries whose files change */
+ShaderProgramLoad ShaderPrograms[] = {
+	{ "TextureRender.vert", "TextureRender.frag", &textureProgramID },
+	{ "Sample_GL3.vert", "Sample_GL3.frag", &programID },
+	// Instanced meshes share the fragment shader, per instance data replaces the MVP
+	{ "Instanced.vert", "Sample_GL3.frag", &instancedProgramID },
+	// Circles and regular polygons evaluated as signed distance fields on a quad
+	{ "SDFShape.vert", "SDFShape.frag", &shapeProgramID },
+	// Composite meshes of SDF parts share the shape fragment shader
+	{ "CompositeShape.vert", "SDFShape.frag", &compositeProgramID },
+	// Rectangles and seven-segment digits generated from gl_VertexID, no vertex buffer
+	{ "Quad.vert", "Sample_GL3.frag", &quadProgramID },
+	{ "Segment.vert", "Sample_GL3.frag", &segmentProgramID },
+	{ "fontrender.vert", "fontrender.frag", &fontProgramID }
+};
+const int NUM_SHADER_PROGRAMS = sizeof(ShaderPrograms)/sizeof(ShaderPrograms[0]);
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
-	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+/* Uniform locations and bindings - set again whenever a program is relinked */
+void configureShaderPrograms ()
+{
+	// Get a handle for our "Model" uniforms
+	Matrices.TexMatrixID = glGetUniformLocation(textureProgramID, "Model");
+	Matrices.MatrixID = glGetUniformLocation(programID, "Model");
+	// Programs that failed to link stay 0 until a reload fixes them
+	for (int i = 0; i < NUM_SHADER_PROGRAMS; i++)
+		if (*ShaderPrograms[i].Program)
+			bindCameraBlock(*ShaderPrograms[i].Program);
+	// Samplers never change unit, so they are set once per link instead of per draw
+	if (textureProgramID) {
+		glsUseProgram(textureProgramID);
+		glUniform1i(glGetUniformLocation(textureProgramID, "texSampler"), 0);
+	}
+	if (fontProgramID) {
+		glsUseProgram(fontProgramID);
+		glUniform1i(glGetUniformLocation(fontProgramID, "glyphAtlas"), 0);
 	}
+}
+
+/* Shader hot reload - watches the working directory, where the shaders live (inotify, Linux only) */
+struct ShaderWatcher {
+	int Fd; // -1 when not watching
+	std::vector<ShaderProgramLoad> Pending; // Relinks still in the compiler
+} ShaderWatch = { -1 };
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+void initShaderWatch ()
+{
+#ifdef __linux__
+	ShaderWatch.Fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	// Editors either rewrite the file or rename a new one over it
+	if (ShaderWatch.Fd >= 0 && inotify_add_watch(ShaderWatch.Fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(ShaderWatch.Fd);
+		ShaderWatch.Fd = -1;
 	}
+	if (ShaderWatch.Fd < 0)
+		cout << "Shader hot reload unavailable" << '\n';
+#endif
+}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
-
-	// Compile Vertex Shader
-	cout << "Compiling shader : " <<  vertex_file_path << endl;
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage( max(InfoLogLength, int(1)) );
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-	cout << VertexShaderErrorMessage.data() << endl;
-
-	// Compile Fragment Shader
-	cout << "Compiling shader : " << fragment_file_path << endl;
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage( max(InfoLogLength, int(1)) );
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-	cout << FragmentShaderErrorMessage.data() << endl;
-
-	// Link the program
-	cout << "Linking program" << endl;
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+void discardShaderProgramLoad (const ShaderProgramLoad& load)
+{
+	glDeleteShader(load.VertexShaderID);
+	glDeleteShader(load.FragmentShaderID);
+	glDeleteProgram(load.ProgramID);
+}
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
-	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-	cout << ProgramErrorMessage.data() << endl;
+// True once the driver finished linking - without parallel compile the status query simply waits
+bool shaderProgramReady (const ShaderProgramLoad& load)
+{
+	if (load.Cached || !GLAD_GL_ARB_parallel_shader_compile)
+		return true;
+	GLint done = GL_FALSE;
+	glGetProgramiv(load.ProgramID, GL_COMPLETION_STATUS_ARB, &done);
+	return done == GL_TRUE;
+}
 
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+void invalidateLayerCaches();
 
-	return ProgramID;
+/* Start relinking the programs of changed shader files, and swap in those that finished - call once per frame */
+void pollShaderWatch ()
+{
+#ifdef __linux__
+	if (ShaderWatch.Fd < 0)
+		return;
+
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t length;
+	while ((length = read(ShaderWatch.Fd, buffer, sizeof(buffer))) > 0) {
+		const struct inotify_event* event;
+		for (char* ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event*)ptr;
+			if (event->len == 0)
+				continue;
+			for (int i = 0; i < NUM_SHADER_PROGRAMS; i++) {
+				const ShaderProgramLoad& program = ShaderPrograms[i];
+				if (strcmp(event->name, program.VertexPath) != 0 && strcmp(event->name, program.FragmentPath) != 0)
+					continue;
+				// A relink started before this save read the old file
+				for (size_t k = 0; k < ShaderWatch.Pending.size(); k++)
+					if (ShaderWatch.Pending[k].Program == program.Program) {
+						discardShaderProgramLoad(ShaderWatch.Pending[k]);
+						ShaderWatch.Pending.erase(ShaderWatch.Pending.begin() + k);
+						break;
+					}
+				ShaderProgramLoad load = { program.VertexPath, program.FragmentPath, program.Program };
+				beginShaderPrograms(&load, 1);
+				ShaderWatch.Pending.push_back(load);
+			}
+		}
+	}
+#endif
+
+	// Swap finished programs in between frames - a failed link keeps the old program
+	bool swapped = false;
+	for (size_t k = 0; k < ShaderWatch.Pending.size(); ) {
+		ShaderProgramLoad& load = ShaderWatch.Pending[k];
+		if (!shaderProgramReady(load)) {
+			k++;
+			continue;
+		}
+		if (finishShaderPrograms(&load, 1)) {
+			cout << "Reloaded " << load.VertexPath << ", " << load.FragmentPath << '\n';
+			swapped = true;
+		}
+		ShaderWatch.Pending.erase(ShaderWatch.Pending.begin() + k);
+	}
+	if (swapped) {
+		glsInvalidate(); // The cached program may have been deleted
+		configureShaderPrograms();
+		invalidateLayerCaches(); // Their textures were rendered with the old shaders
+	}
+}
+
+void releaseShaderWatch ()
+{
+	for (size_t k = 0; k < ShaderWatch.Pending.size(); k++)
+		discardShaderProgramLoad(ShaderWatch.Pending[k]);
+	ShaderWatch.Pending.clear();
+#ifdef __linux__
+	if (ShaderWatch.Fd >= 0)
+		close(ShaderWatch.Fd);
+	ShaderWatch.Fd = -1;
+#endif
 }
 
 static void error_callback(int error, const char* description)
@@ -126,8 +836,11 @@ static void error_callback(int error, const char* description)
 	cout << "Error: " << description << endl;
 }
 
+void releaseGLResources();
+
 void quit(GLFWwindow *window)
 {
+	releaseGLResources();
 	glfwDestroyWindow(window);
 	glfwTerminate();
 	exit(EXIT_SUCCESS);
@@ -153,42 +866,351 @@ glm::vec3 getRGBfromHue (int hue)
 		return glm::vec3(1,0,x);
 }
 
-/* Generate VAO, VBOs and return VAO handle */
+/* Ring buffer for per frame vertex and instance data, split in segments the GPU may still be reading */
+const int STREAM_SEGMENTS = 3;
+struct StreamBuffer {
+	GLBuffer Buffer;
+	GLsizeiptr SegmentSize;
+	int Segment; // Segment being filled
+	GLsizeiptr Used; // Bytes of the segment handed out so far
+	GLsync Fences[STREAM_SEGMENTS]; // Signalled once the GPU is done with the segment, 0 if unused
+	GLubyte* Persistent; // Permanent mapping of the whole buffer with ARB_buffer_storage, NULL otherwise
+} Stream;
+
+/* Create the stream buffer - persistently mapped when ARB_buffer_storage is available */
+void initStreamBuffer (GLsizeiptr segment_size)
+{
+	Stream.Buffer = genBuffer();
+	Stream.SegmentSize = segment_size;
+	Stream.Segment = 0;
+	Stream.Used = 0;
+	for (int i = 0; i < STREAM_SEGMENTS; i++)
+		Stream.Fences[i] = 0;
+	Stream.Persistent = NULL;
+
+	glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+	GLsizeiptr size = STREAM_SEGMENTS*segment_size;
+	if (GLAD_GL_ARB_buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage (GL_ARRAY_BUFFER, size, NULL, flags);
+		Stream.Persistent = (GLubyte*)glMapBufferRange (GL_ARRAY_BUFFER, 0, size, flags);
+	}
+	else
+		glBufferData (GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+}
+
+/* Fence the segment being filled and move to the next one, waiting until the GPU has finished reading it */
+void streamNextSegment ()
+{
+	if (Stream.Fences[Stream.Segment])
+		glDeleteSync (Stream.Fences[Stream.Segment]);
+	Stream.Fences[Stream.Segment] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	Stream.Segment = (Stream.Segment + 1) % STREAM_SEGMENTS;
+	Stream.Used = 0;
+	GLsync fence = Stream.Fences[Stream.Segment];
+	if (fence) {
+		while (glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+			;
+		glDeleteSync (fence);
+		Stream.Fences[Stream.Segment] = 0;
+	}
+}
+
+/* Copy data into the current segment - returns its offset in the buffer, or -1 if it can never fit */
+GLintptr streamUpload (const void* data, GLsizeiptr size)
+{
+	if (size > Stream.SegmentSize) {
+		cout << "Error: " << size << " bytes do not fit in a stream buffer segment" << endl;
+		return -1;
+	}
+	if (Stream.Used + size > Stream.SegmentSize)
+		streamNextSegment();
+
+	GLintptr offset = Stream.Segment*Stream.SegmentSize + Stream.Used;
+	Stream.Used += (size + 15) & ~(GLsizeiptr)15; // Keep every upload 16 byte aligned
+
+	if (Stream.Persistent)
+		memcpy (Stream.Persistent + offset, data, size);
+	else {
+		// The fences guarantee the GPU is not reading this range, so the driver need not synchronize
+		glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+		void* ptr = glMapBufferRange (GL_ARRAY_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		memcpy (ptr, data, size);
+		glUnmapBuffer (GL_ARRAY_BUFFER);
+	}
+	return offset;
+}
+
+/* Release the fences - the buffer itself goes with its handle */
+void releaseStreamBuffer ()
+{
+	for (int i = 0; i < STREAM_SEGMENTS; i++)
+		if (Stream.Fences[i]) {
+			glDeleteSync (Stream.Fences[i]);
+			Stream.Fences[i] = 0;
+		}
+	Stream.Persistent = NULL;
+	Stream.Buffer.reset();
+}
+
+/* Point the shared color VAO at the color pool's current VBO */
+void bindColorFormat ()
+{
+	glsBindVertexArray (Geometry.ColorVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Geometry.Color.VertexBuffer);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(ColorVertex), (void*)offsetof(ColorVertex, Position)); // attribute 0. Vertices (z reads as 0)
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ColorVertex), (void*)offsetof(ColorVertex, Color)); // attribute 1. Color
+	glsEnableVertexAttribArray(0);
+	glsEnableVertexAttribArray(1);
+}
+
+/* Point the shared VAOs that read the flat pool at its current VBO */
+void bindFlatFormat ()
+{
+	// Attribute 1 stays disabled, flat meshes take their color from the constant value of the attribute
+	GLuint positionOnly[] = { Geometry.FlatVAO, Geometry.InstancedVAO, Geometry.ShapeVAO };
+	for (int i = 0; i < 3; i++) {
+		glsBindVertexArray (positionOnly[i]);
+		glsBindBuffer (GL_ARRAY_BUFFER, Geometry.Flat.VertexBuffer);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(FlatVertex), (void*)offsetof(FlatVertex, Position)); // attribute 0. Vertices (z reads as 0)
+		glsEnableVertexAttribArray(0);
+	}
+}
+
+/* Point the shared textured VAO at the textured pool's current VBO */
+void bindTexturedFormat ()
+{
+	glsBindVertexArray (Geometry.TexturedVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Geometry.Textured.VertexBuffer);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(TexturedVertex), (void*)offsetof(TexturedVertex, Position)); // attribute 0. Vertices (z reads as 0)
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(TexturedVertex), (void*)offsetof(TexturedVertex, TexCoord)); // attribute 2. Textures
+	glsEnableVertexAttribArray(0);
+	glsEnableVertexAttribArray(2);
+}
+
+/* Point the shared composite VAO at the composite pool's current VBO */
+void bindCompositeFormat ()
+{
+	GLsizei stride = Geometry.Composite.Stride;
+
+	glsBindVertexArray (Geometry.CompositeVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Geometry.Composite.VertexBuffer);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (void*)0); // attribute 0. Part center
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(2*sizeof(GLfloat))); // attribute 1. Color
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(5*sizeof(GLfloat))); // attribute 2. Quad corner
+	glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, stride, (void*)(7*sizeof(GLfloat))); // attribute 5. Part (radius,sides,rotation,threshold)
+	glsEnableVertexAttribArray(0);
+	glsEnableVertexAttribArray(1);
+	glsEnableVertexAttribArray(2);
+	glsEnableVertexAttribArray(5);
+}
+
+/* Point the per instance attributes of each instanced VAO at data streamed to offset base of the stream buffer */
+void pointInstanceStream (GLintptr base)
+{
+	glsBindVertexArray (Geometry.InstancedVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + offsetof(Instance, Translate))); // attribute 3. Translate (x,y)
+	glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + offsetof(Instance, Scale)));     // attribute 4. Scale
+	glVertexAttribPointer(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance), (void*)(base + offsetof(Instance, Color))); // attribute 5. Color
+}
+
+void pointShapeStream (GLintptr base)
+{
+	glsBindVertexArray (Geometry.ShapeVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(ShapeInstance), (void*)(base + offsetof(ShapeInstance, Center))); // attribute 3. Center (x,y)
+	glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(ShapeInstance), (void*)(base + offsetof(ShapeInstance, Radius))); // attribute 4. Radius
+	glVertexAttribPointer(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ShapeInstance), (void*)(base + offsetof(ShapeInstance, Color))); // attribute 5. Color
+	glVertexAttribPointer(6, 2, GL_FLOAT, GL_FALSE, sizeof(ShapeInstance), (void*)(base + offsetof(ShapeInstance, Sides)));  // attribute 6. Shape (sides,rotation)
+}
+
+void pointCompositeStream (GLintptr base)
+{
+	glsBindVertexArray (Geometry.CompositeVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(CompositeInstance), (void*)(base + offsetof(CompositeInstance, Translate))); // attribute 3. Translate (x,y)
+	glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(CompositeInstance), (void*)(base + offsetof(CompositeInstance, Damage)));    // attribute 4. Damage
+}
+
+void pointQuadStream (GLintptr base)
+{
+	glsBindVertexArray (Geometry.QuadVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(QuadInstance), (void*)(base + offsetof(QuadInstance, Translate))); // attribute 3. Translate (x,y)
+	glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, sizeof(QuadInstance), (void*)(base + offsetof(QuadInstance, Size)));      // attribute 4. Size (w,h)
+	glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, sizeof(QuadInstance), (void*)(base + offsetof(QuadInstance, Rotation)));  // attribute 5. Rotation
+	glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(QuadInstance), (void*)(base + offsetof(QuadInstance, Color))); // attribute 6. Color
+}
+
+void pointDigitStream (GLintptr base)
+{
+	glsBindVertexArray (Geometry.DigitVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+	glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(DigitInstance), (void*)(base + offsetof(DigitInstance, Translate))); // attribute 3. Translate (x,y)
+	glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(DigitInstance), (void*)(base + offsetof(DigitInstance, Segments)));   // attribute 4. Segment mask, as an integer
+	glVertexAttribPointer(5, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(DigitInstance), (void*)(base + offsetof(DigitInstance, Color))); // attribute 5. Color
+}
+
+void pointTextStream (GLintptr base)
+{
+	glsBindVertexArray (Geometry.TextVAO);
+	glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)(base + offsetof(TextVertex, Position))); // attribute 0. Vertices
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(TextVertex), (void*)(base + offsetof(TextVertex, Color))); // attribute 1. Color
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)(base + offsetof(TextVertex, TexCoord))); // attribute 2. Atlas coordinates
+}
+
+/* Create the pool VBOs and shared VAOs - must run after initStreamBuffer and before any create3DObject */
+void initGeometryPools ()
+{
+	Geometry.ColorVAO = genVertexArray();
+	Geometry.FlatVAO = genVertexArray();
+	Geometry.TexturedVAO = genVertexArray();
+	Geometry.InstancedVAO = genVertexArray();
+	Geometry.ShapeVAO = genVertexArray();
+	Geometry.CompositeVAO = genVertexArray();
+	Geometry.QuadVAO = genVertexArray();
+	Geometry.TextVAO = genVertexArray();
+	Geometry.DigitVAO = genVertexArray();
+
+	GeometryPool* pools[] = { &Geometry.Color, &Geometry.Flat, &Geometry.Textured, &Geometry.Composite };
+	GLsizei strides[] = { sizeof(ColorVertex), sizeof(FlatVertex), sizeof(TexturedVertex), 11*sizeof(GLfloat) };
+	GLint capacities[] = { 4096, 16384, 1024, 256 };
+	for (int i = 0; i < 4; i++) {
+		pools[i]->Stride = strides[i];
+		pools[i]->Capacity = capacities[i];
+		pools[i]->Used = 0;
+		pools[i]->VertexBuffer = genBuffer();
+		glsBindBuffer (GL_ARRAY_BUFFER, pools[i]->VertexBuffer);
+		glBufferData (GL_ARRAY_BUFFER, pools[i]->Capacity*pools[i]->Stride, NULL, GL_STATIC_DRAW);
+	}
+	Geometry.Color.BindFormat = bindColorFormat;
+	Geometry.Flat.BindFormat = bindFlatFormat;
+	Geometry.Textured.BindFormat = bindTexturedFormat;
+	Geometry.Composite.BindFormat = bindCompositeFormat;
+	bindColorFormat();
+	bindFlatFormat();
+	bindTexturedFormat();
+	bindCompositeFormat();
+
+	// Per instance data of the instanced, SDF shape, composite, quad and segment shaders lives in the stream buffer
+	pointInstanceStream(0);
+	pointShapeStream(0);
+	pointCompositeStream(0);
+	pointQuadStream(0);
+	pointTextStream(0);
+	glsEnableVertexAttribArray(0);
+	glsEnableVertexAttribArray(1);
+	glsEnableVertexAttribArray(2);
+	pointDigitStream(0);
+	GLuint instanced[] = { Geometry.InstancedVAO, Geometry.ShapeVAO, Geometry.CompositeVAO, Geometry.QuadVAO, Geometry.DigitVAO };
+	GLuint lastAttrib[] = { 5, 6, 4, 6, 5 };
+	for (int i = 0; i < 5; i++) {
+		glsBindVertexArray (instanced[i]);
+		for (GLuint attrib = 3; attrib <= lastAttrib[i]; attrib++) {
+			glsEnableVertexAttribArray(attrib);
+			glVertexAttribDivisor(attrib, 1); // Advance once per instance, not per vertex
+		}
+	}
+}
+
+/* Copy interleaved vertices into the pool, growing its VBO when full - returns the first vertex */
+GLint allocateGeometry (GeometryPool& pool, int numVertices, const void* interleaved_data)
+{
+	if (pool.Used + numVertices > pool.Capacity) {
+		GLint capacity = pool.Capacity;
+		while (pool.Used + numVertices > capacity)
+			capacity *= 2;
+
+		// Move what is already allocated into a bigger VBO and repoint the shared VAOs
+		GLBuffer buffer = genBuffer();
+		glBindBuffer (GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData (GL_COPY_WRITE_BUFFER, capacity*pool.Stride, NULL, GL_STATIC_DRAW);
+		glBindBuffer (GL_COPY_READ_BUFFER, pool.VertexBuffer);
+		glCopyBufferSubData (GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, pool.Used*pool.Stride);
+		pool.VertexBuffer = std::move(buffer); // Releases the old VBO
+		pool.Capacity = capacity;
+		pool.BindFormat();
+	}
+
+	GLint first = pool.Used;
+	glsBindBuffer (GL_ARRAY_BUFFER, pool.VertexBuffer);
+	glBufferSubData (GL_ARRAY_BUFFER, first*pool.Stride, numVertices*pool.Stride, interleaved_data);
+	pool.Used += numVertices;
+	return first;
+}
+
+/* Meshes created so far - source of VAO::MeshIndex */
+GLuint mesh_count = 0;
+
+/* Meshes by content - identical create calls share one handle, so meshes must never be modified */
+std::map<std::string, struct VAO*> mesh_cache;
+
+/* Cache key - pool, draw modes, texture, flat color and the interleaved vertex data */
+static std::string meshKey (const GeometryPool& pool, GLenum primitive_mode, GLenum fill_mode, GLuint textureID, PackedColor flat_color, int numVertices, const void* interleaved)
+{
+	const GeometryPool* pool_address = &pool;
+	std::string key((const char*)&pool_address, sizeof(pool_address));
+	key.append((const char*)&primitive_mode, sizeof(primitive_mode));
+	key.append((const char*)&fill_mode, sizeof(fill_mode));
+	key.append((const char*)&textureID, sizeof(textureID));
+	key.append((const char*)&flat_color, sizeof(flat_color));
+	key.append((const char*)interleaved, numVertices*pool.Stride);
+	return key;
+}
+
+/* Store the mesh in the color pool, or the flat pool if all vertices share one color, and return its handle */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
-	struct VAO* vao = new struct VAO;
+	// Meshes lie in the XY plane - z is dropped and colors are packed to RGBA8
+	std::vector<ColorVertex> vertices(numVertices);
+	bool flat = true;
+	for (int i=0; i<numVertices; i++) {
+		vertices[i].Position[0] = vertex_buffer_data[3*i];
+		vertices[i].Position[1] = vertex_buffer_data[3*i + 1];
+		vertices[i].Color = packColor(color_buffer_data[3*i], color_buffer_data[3*i + 1], color_buffer_data[3*i + 2]);
+		flat = flat && vertices[i].Color == vertices[0].Color;
+	}
+	std::vector<FlatVertex> flat_vertices;
+	if (flat) {
+		flat_vertices.resize(numVertices);
+		for (int i=0; i<numVertices; i++) {
+			flat_vertices[i].Position[0] = vertices[i].Position[0];
+			flat_vertices[i].Position[1] = vertices[i].Position[1];
+		}
+	}
+	GeometryPool& pool = flat ? Geometry.Flat : Geometry.Color;
+	const void* interleaved = flat ? (const void*)&flat_vertices[0] : (const void*)&vertices[0];
+	PackedColor flat_color = flat ? vertices[0].Color : packColor(0, 0, 0, 0);
+
+	// Reuse an identical mesh if there is one
+	struct VAO*& vao = mesh_cache[meshKey(pool, primitive_mode, fill_mode, 0, flat_color, numVertices, interleaved)];
+	if (vao)
+		return vao;
+
+	vao = new struct VAO;
 	vao->PrimitiveMode = primitive_mode;
 	vao->NumVertices = numVertices;
 	vao->FillMode = fill_mode;
-
-	// Create Vertex Array Object
-	// Should be done after CreateWindow and before any other GL calls
-	glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-	glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-	glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-	glBindVertexArray (vao->VertexArrayID); // Bind the VAO
-	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-	glVertexAttribPointer(
-						  0,                  // attribute 0. Vertices
-						  3,                  // size (x,y,z)
-						  GL_FLOAT,           // type
-						  GL_FALSE,           // normalized?
-						  0,                  // stride
-						  (void*)0            // array buffer offset
-						  );
-
-	glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-	glVertexAttribPointer(
-						  1,                  // attribute 1. Color
-						  3,                  // size (r,g,b)
-						  GL_FLOAT,           // type
-						  GL_FALSE,           // normalized?
-						  0,                  // stride
-						  (void*)0            // array buffer offset
-						  );
+	vao->TextureID = 0;
+	vao->VertexArrayID = flat ? Geometry.FlatVAO : Geometry.ColorVAO;
+	vao->IsQuad = false;
+	vao->MeshIndex = mesh_count++;
+	vao->FlatColor = flat_color;
+	vao->FirstVertex = allocateGeometry(pool, numVertices, interleaved);
+
+	// Keep a CPU copy so the sprite batcher can transform the vertices itself
+	vao->Vertices.resize(2*numVertices);
+	resetBounds(vao->Bounds);
+	for (int i=0; i<numVertices; i++) {
+		vao->Vertices[2*i] = vertices[i].Position[0];
+		vao->Vertices[2*i + 1] = vertices[i].Position[1];
+		growBounds(vao->Bounds, vertices[i].Position[0], vertices[i].Position[1]);
+		if (!flat)
+			vao->Colors.push_back(vertices[i].Color);
+	}
 
 	return vao;
 }
@@ -196,52 +1218,117 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-	GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+	std::vector<GLfloat> color_buffer_data (3*numVertices);
 	for (int i=0; i<numVertices; i++) {
 		color_buffer_data [3*i] = red;
 		color_buffer_data [3*i + 1] = green;
 		color_buffer_data [3*i + 2] = blue;
 	}
 
-	return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+	return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
 }
 
+/* Store the textured mesh in the textured pool and return its handle */
 struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* texture_buffer_data, GLuint textureID, GLenum fill_mode=GL_FILL)
 {
-	struct VAO* vao = new struct VAO;
+	// Interleave vertices and texture coordinates - (x,y,s,t) per vertex, z is dropped
+	std::vector<TexturedVertex> interleaved(numVertices);
+	for (int i=0; i<numVertices; i++) {
+		for (int k=0; k<2; k++) {
+			interleaved[i].Position[k] = vertex_buffer_data[3*i + k];
+			interleaved[i].TexCoord[k] = texture_buffer_data[2*i + k];
+		}
+	}
+
+	// Reuse an identical mesh if there is one
+	struct VAO*& vao = mesh_cache[meshKey(Geometry.Textured, primitive_mode, fill_mode, textureID, packColor(0, 0, 0, 0), numVertices, &interleaved[0])];
+	if (vao)
+		return vao;
+
+	vao = new struct VAO;
 	vao->PrimitiveMode = primitive_mode;
 	vao->NumVertices = numVertices;
 	vao->FillMode = fill_mode;
 	vao->TextureID = textureID;
+	vao->VertexArrayID = Geometry.TexturedVAO;
+	vao->IsQuad = false;
+	vao->MeshIndex = mesh_count++;
+	vao->FlatColor = packColor(1, 1, 1);
+	vao->FirstVertex = allocateGeometry(Geometry.Textured, numVertices, &interleaved[0]);
+	resetBounds(vao->Bounds);
+	for (int i=0; i<numVertices; i++)
+		growBounds(vao->Bounds, interleaved[i].Position[0], interleaved[i].Position[1]);
+
+	return vao;
+}
+
+/* Handle to a flat color quad from (0,0) to (width,height) - nothing is stored, the quad shader builds it */
+struct VAO* createQuad (GLfloat width, GLfloat height, GLfloat red, GLfloat green, GLfloat blue)
+{
+	// Identical rectangles share one handle - keyed like pool meshes, with no pool and the size as the only "vertex"
+	const GeometryPool* no_pool = NULL;
+	GLenum primitive_mode = GL_TRIANGLE_STRIP, fill_mode = GL_FILL;
+	GLuint textureID = 0;
+	PackedColor flat_color = packColor(red, green, blue);
+	GLfloat size[2] = { width, height };
+	std::string key((const char*)&no_pool, sizeof(no_pool));
+	key.append((const char*)&primitive_mode, sizeof(primitive_mode));
+	key.append((const char*)&fill_mode, sizeof(fill_mode));
+	key.append((const char*)&textureID, sizeof(textureID));
+	key.append((const char*)&flat_color, sizeof(flat_color));
+	key.append((const char*)size, sizeof(size));
+	struct VAO*& vao = mesh_cache[key];
+	if (vao)
+		return vao;
+
+	vao = new struct VAO;
+	vao->PrimitiveMode = GL_TRIANGLE_STRIP;
+	vao->NumVertices = 4;
+	vao->FirstVertex = 0;
+	vao->FillMode = GL_FILL;
+	vao->TextureID = 0;
+	vao->VertexArrayID = Geometry.QuadVAO;
+	vao->IsQuad = true;
+	vao->MeshIndex = mesh_count++;
+	vao->FlatColor = packColor(red, green, blue);
+	vao->QuadSize[0] = width;
+	vao->QuadSize[1] = height;
+	resetBounds(vao->Bounds);
+	growBounds(vao->Bounds, 0, 0);
+	growBounds(vao->Bounds, width, height);
 
-	// Create Vertex Array Object
-	// Should be done after CreateWindow and before any other GL calls
-	glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-	glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-	glGenBuffers (1, &(vao->TextureBuffer));  // VBO - textures
-
-	glBindVertexArray (vao->VertexArrayID); // Bind the VAO
-	glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices
-	glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-	glVertexAttribPointer(
-						  0,                  // attribute 0. Vertices
-						  3,                  // size (x,y,z)
-						  GL_FLOAT,           // type
-						  GL_FALSE,           // normalized?
-						  0,                  // stride
-						  (void*)0            // array buffer offset
-						  );
-
-	glBindBuffer (GL_ARRAY_BUFFER, vao->TextureBuffer); // Bind the VBO textures
-	glBufferData (GL_ARRAY_BUFFER, 2*numVertices*sizeof(GLfloat), texture_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-	glVertexAttribPointer(
-						  2,                  // attribute 2. Textures
-						  2,                  // size (s,t)
-						  GL_FLOAT,           // type
-						  GL_FALSE,           // normalized?
-						  0,                  // stride
-						  (void*)0            // array buffer offset
-						  );
+	return vao;
+}
+
+/* Bake the parts into one mesh of quads in the composite pool - parts are drawn in array order */
+struct VAO* createCompositeShape (int numParts, const ShapePart* parts)
+{
+	struct VAO* vao = new struct VAO;
+	vao->PrimitiveMode = GL_TRIANGLES;
+	vao->NumVertices = 6*numParts;
+	vao->FillMode = GL_FILL;
+	vao->TextureID = 0;
+	vao->VertexArrayID = Geometry.CompositeVAO;
+	vao->IsQuad = false;
+	vao->MeshIndex = mesh_count++;
+	vao->FlatColor = packColor(1, 1, 1);
+
+	// Two triangles per part - (cx,cy,r,g,b,qx,qy,radius,sides,rotation,threshold) per vertex
+	const GLfloat corners[] = { -1,-1, 1,-1, 1,1, -1,-1, 1,1, -1,1 };
+	std::vector<GLfloat> interleaved;
+	interleaved.reserve(11*vao->NumVertices);
+	resetBounds(vao->Bounds);
+	for (int i=0; i<numParts; i++) {
+		const ShapePart& part = parts[i];
+		growBounds(vao->Bounds, part.Center[0] - part.Radius, part.Center[1] - part.Radius);
+		growBounds(vao->Bounds, part.Center[0] + part.Radius, part.Center[1] + part.Radius);
+		for (int v=0; v<6; v++) {
+			const GLfloat vertex[] = { part.Center[0], part.Center[1], part.Color[0], part.Color[1], part.Color[2],
+				corners[2*v], corners[2*v+1], part.Radius, part.Sides, part.Rotation, part.Threshold };
+			interleaved.insert(interleaved.end(), vertex, vertex + 11);
+		}
+	}
+	vao->FirstVertex = allocateGeometry(Geometry.Composite, vao->NumVertices, &interleaved[0]);
 
 	return vao;
 }
@@ -250,61 +1337,817 @@ struct VAO* create3DTexturedObject (GLenum primitive_mode, int numVertices, cons
 void draw3DObject (struct VAO* vao)
 {
 	// Change the Fill Mode for this object
-	glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
+	glsPolygonMode (vao->FillMode);
 
-	// Bind the VAO to use
-	glBindVertexArray (vao->VertexArrayID);
+	// Bind the shared VAO of the mesh's pool - attributes are set up already
+	glsBindVertexArray (vao->VertexArrayID);
 
-	// Enable Vertex Attribute 0 - 3d Vertices
-	glEnableVertexAttribArray(0);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+	// Flat color meshes have no color stream, the constant value of the attribute is used instead
+	if (vao->Colors.empty())
+		glVertexAttrib4Nub(1, vao->FlatColor.R, vao->FlatColor.G, vao->FlatColor.B, vao->FlatColor.A);
 
-	// Enable Vertex Attribute 1 - Color
-	glEnableVertexAttribArray(1);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+	// Draw the geometry !
+	glDrawArrays(vao->PrimitiveMode, vao->FirstVertex, vao->NumVertices); // Starting from the mesh's offset in the pool
+}
+
+/* Sprite batcher - collects world space triangles of the normal shader and draws them in one call */
+struct SpriteBatch {
+	GLVertexArray VertexArrayID;
+
+	std::vector<ColorVertex> Vertices; // Pending vertices, already transformed by their model matrix
+} Batch;
+
+/* Point the sprite batcher's VAO at vertices streamed to offset base - same layout as the color pool */
+static void pointBatchStream (GLintptr base)
+{
+	glsBindVertexArray (Batch.VertexArrayID);
+	glsBindBuffer (GL_ARRAY_BUFFER, Stream.Buffer);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(ColorVertex), (void*)(base + offsetof(ColorVertex, Position))); // attribute 0. Vertices
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ColorVertex), (void*)(base + offsetof(ColorVertex, Color))); // attribute 1. Color
+}
+
+/* Create the VAO used by the sprite batcher - its vertices go through the stream buffer */
+void initSpriteBatch ()
+{
+	Batch.VertexArrayID = genVertexArray(); // VAO
+
+	pointBatchStream(0);
+	glsEnableVertexAttribArray(0);
+	glsEnableVertexAttribArray(1);
+}
+
+/* Draw everything collected by the sprite batcher so far - the normal shader must be in use */
+void flushSpriteBatch ()
+{
+	if (Batch.Vertices.empty())
+		return;
+
+	// Vertices are in world space already, the camera block does the rest
+	glsUniformMatrix3fv(Matrices.MatrixID, glm::mat3(1.0f));
+
+	glsPolygonMode (GL_FILL);
+
+	GLintptr offset = streamUpload(&Batch.Vertices[0], Batch.Vertices.size()*sizeof(ColorVertex));
+	if (offset >= 0) {
+		pointBatchStream(offset);
+		glDrawArrays(GL_TRIANGLES, 0, Batch.Vertices.size());
+	}
+
+	Batch.Vertices.clear();
+}
+
+/* Switch shader program - pending batched geometry belongs to the old one, so flush it first */
+void useProgram (GLuint program)
+{
+	if (program == GLState.Program)
+		return;
+	flushSpriteBatch();
+	glsUseProgram(program);
+}
+
+/* Bind a texture for the next draws - pending batched geometry is flushed first */
+void bindTexture (GLuint textureID)
+{
+	flushSpriteBatch();
+	glsBindTexture(textureID);
+}
+
+/* Append vertex i of the VAO to the batch after transforming it by the model matrix */
+static void batchVertex (struct VAO* vao, int i, const glm::mat3& model)
+{
+	glm::vec3 v = model * glm::vec3(vao->Vertices[2*i], vao->Vertices[2*i+1], 1);
+	ColorVertex vertex = { { v.x, v.y }, vao->Colors.empty() ? vao->FlatColor : vao->Colors[i] };
+	Batch.Vertices.push_back(vertex);
+}
+
+/* Queue the VAO with the normal shader, falling back to a direct draw for anything but filled triangles */
+void batch3DObject (struct VAO* vao, const glm::mat3& model)
+{
+	useProgram(programID);
+
+	int n = vao->NumVertices;
+	bool batchable = vao->FillMode == GL_FILL && !vao->Vertices.empty() &&
+		(vao->PrimitiveMode == GL_TRIANGLES || vao->PrimitiveMode == GL_TRIANGLE_FAN || vao->PrimitiveMode == GL_TRIANGLE_STRIP);
+	if (!batchable) {
+		flushSpriteBatch();
+		glsUniformMatrix3fv(Matrices.MatrixID, model);
+		draw3DObject(vao);
+		return;
+	}
+
+	// Expand fans and strips into independent triangles so everything shares one draw
+	if (vao->PrimitiveMode == GL_TRIANGLES) {
+		for (int i = 0; i < n; i++)
+			batchVertex(vao, i, model);
+	}
+	else if (vao->PrimitiveMode == GL_TRIANGLE_FAN) {
+		for (int i = 1; i+1 < n; i++) {
+			batchVertex(vao, 0, model);
+			batchVertex(vao, i, model);
+			batchVertex(vao, i+1, model);
+		}
+	}
+	else {
+		for (int i = 0; i+2 < n; i++) {
+			batchVertex(vao, i, model);
+			batchVertex(vao, i+1, model);
+			batchVertex(vao, i+2, model);
+		}
+	}
+}
+
+void draw3DTexturedObject (struct VAO* vao)
+{
+	// Change the Fill Mode for this object
+	glsPolygonMode (vao->FillMode);
+
+	// Bind the shared VAO of the textured pool - attributes are set up already
+	glsBindVertexArray (vao->VertexArrayID);
+
+	// Bind Textures using texture units
+	bindTexture(vao->TextureID);
 
 	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+	glDrawArrays(vao->PrimitiveMode, vao->FirstVertex, vao->NumVertices); // Starting from the mesh's offset in the pool
+
+	// The texture stays bound - the next sprite from the same atlas page needs no bind at all
+}
+
+/* Render all shapes as one quad each in a single draw call - use with the SDF shape shader, the quad must be flat color */
+void draw3DShapes (struct VAO* vao, const std::vector<ShapeInstance>& shapes)
+{
+	if (shapes.empty())
+		return;
+
+	GLintptr offset = streamUpload(&shapes[0], shapes.size()*sizeof(ShapeInstance));
+	if (offset < 0)
+		return;
+
+	glsPolygonMode (vao->FillMode);
+	pointShapeStream(offset);
+
+	// Edges are anti-aliased through alpha, so blend only for this pass
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArraysInstanced(vao->PrimitiveMode, vao->FirstVertex, vao->NumVertices, shapes.size());
+	glDisable(GL_BLEND);
+}
+
+/* Render every instance of a composite mesh in a single draw call - use with the composite shape shader */
+void draw3DComposite (struct VAO* vao, const std::vector<CompositeInstance>& instances)
+{
+	if (instances.empty())
+		return;
+
+	GLintptr offset = streamUpload(&instances[0], instances.size()*sizeof(CompositeInstance));
+	if (offset < 0)
+		return;
+
+	glsPolygonMode (vao->FillMode);
+	pointCompositeStream(offset);
+
+	// Parts are SDF shapes with alpha edges, blended like draw3DShapes
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArraysInstanced(vao->PrimitiveMode, vao->FirstVertex, vao->NumVertices, instances.size());
+	glDisable(GL_BLEND);
+}
+
+/* Render all quads in a single draw call with no vertex buffer - use with the quad shader */
+void draw3DQuads (const std::vector<QuadInstance>& quads)
+{
+	if (quads.empty())
+		return;
+
+	GLintptr offset = streamUpload(&quads[0], quads.size()*sizeof(QuadInstance));
+	if (offset < 0)
+		return;
+
+	glsPolygonMode (GL_FILL);
+	pointQuadStream(offset);
+
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, quads.size());
+}
+
+/* Render every digit of every number in a single draw call - use with the segment shader */
+void draw3DDigits (const std::vector<DigitInstance>& digits)
+{
+	if (digits.empty())
+		return;
+
+	GLintptr offset = streamUpload(&digits[0], digits.size()*sizeof(DigitInstance));
+	if (offset < 0)
+		return;
+
+	glsPolygonMode (GL_FILL);
+	pointDigitStream(offset);
+
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 7*6, digits.size()); // Two triangles for each of the seven segments
+}
+
+/* Render laid out glyph quads in a single draw call - use with the font shader */
+void draw3DText (const std::vector<TextVertex>& vertices)
+{
+	if (vertices.empty())
+		return;
+
+	GLintptr offset = streamUpload(&vertices[0], vertices.size()*sizeof(TextVertex));
+	if (offset < 0)
+		return;
+
+	glsPolygonMode (GL_FILL);
+	pointTextStream(offset);
+	bindTexture(Font.Texture);
+
+	// Glyph coverage is alpha, so blend only for this pass - destination alpha stays premultiplied for cached layers
+	glEnable(GL_BLEND);
+	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+	glDisable(GL_BLEND);
+}
+
+/* Render every instance of the VAO with a single draw call - use with the instanced shader, the mesh must be flat color */
+void draw3DObjectInstanced (struct VAO* vao, const Instance* instances, GLsizei numInstances)
+{
+	if (numInstances == 0)
+		return;
+
+	GLintptr offset = streamUpload(instances, numInstances*sizeof(Instance));
+	if (offset < 0)
+		return;
+
+	glsPolygonMode (vao->FillMode);
+	pointInstanceStream(offset);
+
+	glDrawArraysInstanced(vao->PrimitiveMode, vao->FirstVertex, vao->NumVertices, numInstances);
+}
+
+/* Layers of a frame, drawn back to front - the top field of the render queue sort key */
+enum RenderLayer {
+	LAYER_BACKGROUND, // static layer and the objects rendered into it
+	LAYER_PROPS, // scenery that moving objects pass in front of
+	LAYER_WORLD,
+	LAYER_HUD,
+	LAYER_TEXT,
+	LAYER_COUNT
+};
+
+/* What a render command does when it is executed */
+enum RenderCommandKind {
+	CMD_SPRITE, // mesh through the sprite batcher with the normal shader
+	CMD_TEXTURED, // textured mesh with the texture shader
+	CMD_INSTANCED, // every instance of a mesh with the instanced shader
+	CMD_SHAPES, // SDF shapes with the shape shader
+	CMD_COMPOSITE, // every instance of a composite mesh with the composite shape shader
+	CMD_QUADS, // every procedural quad of a layer with the quad shader
+	CMD_DIGITS, // every seven-segment number of a layer with the segment shader
+	CMD_TEXT // every string of a layer with the font shader
+};
+
+struct RenderCommand {
+	RenderCommandKind Kind;
+	GLuint Program;
+	struct VAO* Mesh;
+	glm::mat3 Model;
+	const Instance* Instances; // CMD_INSTANCED - must live until the queue is executed
+	GLsizei NumInstances; // CMD_INSTANCED
+	const std::vector<ShapeInstance>* Shapes; // CMD_SHAPES - must live until the queue is executed
+	const std::vector<CompositeInstance>* Composites; // CMD_COMPOSITE - must live until the queue is executed
+	const std::vector<QuadInstance>* Quads; // CMD_QUADS - owned by the queue
+	const std::vector<DigitInstance>* Digits; // CMD_DIGITS - owned by the queue
+	const std::vector<TextVertex>* Text; // CMD_TEXT - owned by the queue
+	bool Blend; // CMD_TEXTURED - texture has premultiplied alpha
+};
+
+/* Draw commands of one pass - sorted by key before execution so state changes are grouped */
+struct RenderQueue {
+	std::vector<RenderCommand> Commands;
+	std::vector<unsigned long long> Keys; // Sort keys - the sequence field in the low 24 bits is the command index
+	std::vector<unsigned long long> Scratch;
+	std::vector<QuadInstance> Quads[LAYER_COUNT]; // Procedural quads, one instanced draw per layer
+	std::vector<DigitInstance> Digits[LAYER_COUNT]; // Seven-segment digits of all numbers, one instanced draw per layer
+	std::vector<TextVertex> Text[LAYER_COUNT]; // Glyph quads of all strings, one draw per layer
+};
+
+RenderQueue FrameQueue; // Everything drawn to the screen this frame
+RenderQueue* SubmitQueue = &FrameQueue; // Queue that submissions go to - offscreen passes point this at their own queue
+
+/* Draw order of the programs inside a layer - the program field of the sort key */
+static unsigned long long programRank (GLuint program)
+{
+	const GLuint order[] = { textureProgramID, programID, quadProgramID, instancedProgramID, compositeProgramID, shapeProgramID, segmentProgramID, fontProgramID };
+	for (unsigned long long i = 0; i < sizeof(order)/sizeof(order[0]); i++)
+		if (order[i] == program)
+			return i;
+	return 0xFF;
+}
+
+/* Append a command - key is layer:4 | program:8 | texture:12 | mesh:16 | sequence:24 */
+void submitCommand (RenderLayer layer, const RenderCommand& cmd)
+{
+	RenderQueue& queue = *SubmitQueue;
+	unsigned long long texture = cmd.Mesh ? cmd.Mesh->TextureID : 0;
+	// Batched sprites share one draw, so sorting them by mesh gains nothing - keep their submission order instead
+	unsigned long long mesh = (cmd.Mesh && cmd.Kind != CMD_SPRITE) ? cmd.Mesh->MeshIndex : 0;
+	unsigned long long sequence = queue.Commands.size();
+	unsigned long long key = ((unsigned long long)layer & 0xF) << 60 |
+		(programRank(cmd.Program) & 0xFF) << 52 |
+		(texture & 0xFFF) << 40 |
+		(mesh & 0xFFFF) << 24 |
+		(sequence & 0xFFFFFF);
+	queue.Commands.push_back(cmd);
+	queue.Keys.push_back(key);
+}
+
+/* Add a procedural quad to the layer's quad list - the first one in a layer submits the draw for all of them */
+void submitQuad (RenderLayer layer, const QuadInstance& quad)
+{
+	std::vector<QuadInstance>& quads = SubmitQueue->Quads[layer];
+	if (quads.empty()) {
+		RenderCommand cmd = RenderCommand();
+		cmd.Kind = CMD_QUADS;
+		cmd.Program = quadProgramID;
+		cmd.Quads = &quads;
+		submitCommand(layer, cmd);
+	}
+	quads.push_back(quad);
+}
+
+/* Queue a non-negative number as seven-segment digits, the last digit with its top left corner at (x,y) - nothing for 0 */
+void submitNumber (RenderLayer layer, int value, GLfloat x, GLfloat y, glm::vec3 color)
+{
+	std::vector<DigitInstance>& digits = SubmitQueue->Digits[layer];
+	if (digits.empty() && value > 0) {
+		RenderCommand cmd = RenderCommand();
+		cmd.Kind = CMD_DIGITS;
+		cmd.Program = segmentProgramID;
+		cmd.Digits = &digits;
+		submitCommand(layer, cmd);
+	}
+
+	DigitInstance digit;
+	digit.Color = packColor(color[0], color[1], color[2]);
+	for (; value > 0; value /= 10, x -= 25) {
+		digit.Translate[0] = x;
+		digit.Translate[1] = y;
+		digit.Segments = DIGIT_SEGMENTS[value % 10];
+		digits.push_back(digit);
+	}
+}
+
+/* Lay out a string with its baseline starting at (x,y) and an em size of em world units */
+void submitText (RenderLayer layer, const std::string& text, GLfloat x, GLfloat y, GLfloat em, glm::vec3 color)
+{
+	std::vector<TextVertex>& vertices = SubmitQueue->Text[layer];
+	bool first = vertices.empty();
+
+	GLfloat scale = em / Font.PixelSize;
+	PackedColor packed = packColor(color[0], color[1], color[2]);
+	for (size_t i = 0; i < text.size(); i++) {
+		int c = (unsigned char)text[i];
+		if (c < FIRST_GLYPH || c > LAST_GLYPH)
+			c = '?';
+		const Glyph& g = Font.Glyphs[c - FIRST_GLYPH];
+		if (g.Size[0] > 0 && g.Size[1] > 0) {
+			GLfloat x0 = x + g.Bearing[0]*scale, y0 = y + g.Bearing[1]*scale;
+			GLfloat x1 = x0 + g.Size[0]*scale, y1 = y0 + g.Size[1]*scale;
+			TextVertex quad[] = {
+				{ { x0, y0 }, { g.UV[0], g.UV[3] }, packed },
+				{ { x1, y0 }, { g.UV[2], g.UV[3] }, packed },
+				{ { x1, y1 }, { g.UV[2], g.UV[1] }, packed },
+				{ { x0, y0 }, { g.UV[0], g.UV[3] }, packed },
+				{ { x1, y1 }, { g.UV[2], g.UV[1] }, packed },
+				{ { x0, y1 }, { g.UV[0], g.UV[1] }, packed }
+			};
+			vertices.insert(vertices.end(), quad, quad + 6);
+		}
+		x += g.Advance*scale;
+	}
+
+	// The first visible string of the layer queues the draw of all of them
+	if (first && !vertices.empty()) {
+		RenderCommand cmd = RenderCommand();
+		cmd.Kind = CMD_TEXT;
+		cmd.Program = fontProgramID;
+		cmd.Text = &vertices;
+		submitCommand(layer, cmd);
+	}
+}
+
+/* LSD radix sort of the keys, one byte per pass - passes where every key shares the byte are skipped */
+static void sortRenderQueue (RenderQueue& queue)
+{
+	size_t n = queue.Keys.size();
+	queue.Scratch.resize(n);
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t count[257] = {0};
+		for (size_t i = 0; i < n; i++)
+			count[((queue.Keys[i] >> shift) & 0xFF) + 1]++;
+		if (count[((queue.Keys[0] >> shift) & 0xFF) + 1] == n)
+			continue;
+		for (int b = 0; b < 256; b++)
+			count[b+1] += count[b];
+		for (size_t i = 0; i < n; i++)
+			queue.Scratch[count[(queue.Keys[i] >> shift) & 0xFF]++] = queue.Keys[i];
+		queue.Keys.swap(queue.Scratch);
+	}
+}
+
+/* Sort the queue, run every command in key order and empty it */
+void executeRenderQueue (RenderQueue& queue)
+{
+	if (queue.Commands.empty())
+		return;
+	sortRenderQueue(queue);
+
+	for (size_t i = 0; i < queue.Keys.size(); i++) {
+		const RenderCommand& cmd = queue.Commands[queue.Keys[i] & 0xFFFFFF];
+		useProgram(cmd.Program);
+		switch (cmd.Kind) {
+			case CMD_SPRITE:
+				batch3DObject(cmd.Mesh, cmd.Model);
+				break;
+			case CMD_TEXTURED:
+				glsUniformMatrix3fv(Matrices.TexMatrixID, cmd.Model);
+				if (cmd.Blend) {
+					glEnable(GL_BLEND);
+					glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+				}
+				draw3DTexturedObject(cmd.Mesh);
+				if (cmd.Blend)
+					glDisable(GL_BLEND);
+				break;
+			case CMD_INSTANCED:
+				draw3DObjectInstanced(cmd.Mesh, cmd.Instances, cmd.NumInstances);
+				break;
+			case CMD_SHAPES:
+				draw3DShapes(cmd.Mesh, *cmd.Shapes);
+				break;
+			case CMD_COMPOSITE:
+				draw3DComposite(cmd.Mesh, *cmd.Composites);
+				break;
+			case CMD_QUADS:
+				draw3DQuads(*cmd.Quads);
+				break;
+			case CMD_DIGITS:
+				draw3DDigits(*cmd.Digits);
+				break;
+			case CMD_TEXT:
+				draw3DText(*cmd.Text);
+				break;
+		}
+	}
+	flushSpriteBatch();
+
+	queue.Commands.clear();
+	queue.Keys.clear();
+	for (int layer = 0; layer < LAYER_COUNT; layer++) {
+		queue.Quads[layer].clear();
+		queue.Digits[layer].clear();
+		queue.Text[layer].clear();
+	}
+}
+
+/* Rasterize the printable ASCII glyphs of a font at pixel_size into Font - false if the font cannot be loaded */
+bool createGlyphAtlas (const char* filename, int pixel_size)
+{
+	FT_Library library;
+	if (FT_Init_FreeType(&library))
+		return false;
+	FT_Face face;
+	if (FT_New_Face(library, filename, 0, &face)) {
+		FT_Done_FreeType(library);
+		return false;
+	}
+	FT_Set_Pixel_Sizes(face, 0, pixel_size);
+
+	// Shelf packing, with a gap so filtering never picks up a neighbouring glyph
+	const int atlas_size = 512, padding = 2;
+	std::vector<GLubyte> pixels(atlas_size*atlas_size, 0);
+	int x = padding, y = padding, shelf_height = 0;
+	for (int c = FIRST_GLYPH; c <= LAST_GLYPH; c++) {
+		if (FT_Load_Char(face, c, FT_LOAD_RENDER))
+			continue; // Missing glyphs stay empty
+		FT_GlyphSlot slot = face->glyph;
+		int w = slot->bitmap.width, h = slot->bitmap.rows;
+		if (x + w + padding > atlas_size) {
+			x = padding;
+			y += shelf_height + padding;
+			shelf_height = 0;
+		}
+		if (y + h + padding > atlas_size) {
+			cout << "Error: glyph atlas of " << filename << " is full" << endl;
+			break;
+		}
+		for (int row = 0; row < h; row++)
+			memcpy(&pixels[(y + row)*atlas_size + x], slot->bitmap.buffer + row*slot->bitmap.pitch, w);
+
+		Glyph& g = Font.Glyphs[c - FIRST_GLYPH];
+		g.Advance = slot->advance.x / 64.0f;
+		g.Bearing[0] = slot->bitmap_left;
+		g.Bearing[1] = slot->bitmap_top - h;
+		g.Size[0] = w;
+		g.Size[1] = h;
+		g.UV[0] = (GLfloat)x / atlas_size;
+		g.UV[1] = (GLfloat)y / atlas_size;
+		g.UV[2] = (GLfloat)(x + w) / atlas_size;
+		g.UV[3] = (GLfloat)(y + h) / atlas_size;
+
+		x += w + padding;
+		shelf_height = std::max(shelf_height, h);
+	}
+	FT_Done_Face(face);
+	FT_Done_FreeType(library);
+	Font.PixelSize = pixel_size;
+
+	Font.Texture = genTexture();
+	glsBindTexture(Font.Texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Rows of single byte texels
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlas_size, atlas_size, 0, GL_RED, GL_UNSIGNED_BYTE, &pixels[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glsBindTexture(0);
+
+	return true;
+}
+
+/* Create an OpenGL Texture from an image */
+/* Decoded images are cached on disk as raw RGBA8 mip chains, mapped into memory instead of decoding the PNG again */
+const char* TEXTURE_CACHE_DIR = "texture_cache";
+const GLuint TEXTURE_CACHE_MAGIC = 0x43585447; // "GTXC"
+const GLuint TEXTURE_CACHE_VERSION = 1;
+struct TextureCacheHeader {
+	GLuint Magic;
+	GLuint Version;
+	unsigned long long SourceHash; // FNV-1a of the PNG file - a changed image invalidates the entry
+	GLint Width, Height;
+	GLint Levels; // Level i is max(1, Width>>i) x max(1, Height>>i), all levels follow the header
+	GLuint Reserved;
+};
+struct CachedImage {
+	TextureCacheHeader Header;
+	const GLubyte* Levels; // Whole mip chain, level 0 first
+	size_t Size; // Bytes of the chain
+	void* Mapping; // mmap of the cache file, NULL if the chain is in Memory
+	size_t MappingSize;
+	std::vector<GLubyte> Memory; // Only when the cache could not be written
+};
+
+size_t mipChainSize (int width, int height, int levels)
+{
+	size_t size = 0;
+	for (int i = 0; i < levels; i++)
+		size += 4*(size_t)std::max(1, width >> i)*std::max(1, height >> i);
+	return size;
+}
+
+// Next level by averaging 2x2 blocks - the last row or column of odd sizes is reused
+void downsampleRGBA8 (const GLubyte* src, int width, int height, GLubyte* dst)
+{
+	int w = std::max(1, width/2), h = std::max(1, height/2);
+	for (int y = 0; y < h; y++)
+		for (int x = 0; x < w; x++) {
+			int x0 = std::min(2*x, width - 1), x1 = std::min(2*x + 1, width - 1);
+			int y0 = std::min(2*y, height - 1), y1 = std::min(2*y + 1, height - 1);
+			for (int c = 0; c < 4; c++)
+				dst[4*(y*w + x) + c] = (src[4*(y0*width + x0) + c] + src[4*(y0*width + x1) + c] +
+										src[4*(y1*width + x0) + c] + src[4*(y1*width + x1) + c] + 2) / 4;
+		}
+}
+
+// Map the cache file if it holds the chain of the image with this hash
+bool mapTextureCache (const std::string& path, unsigned long long hash, CachedImage& image)
+{
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat info;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(TextureCacheHeader))
+		mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps the file
+	if (mapping == MAP_FAILED)
+		return false;
+
+	const TextureCacheHeader& header = *(const TextureCacheHeader*)mapping;
+	if (header.Magic != TEXTURE_CACHE_MAGIC || header.Version != TEXTURE_CACHE_VERSION || header.SourceHash != hash ||
+		header.Width <= 0 || header.Height <= 0 || header.Levels <= 0 ||
+		sizeof(header) + mipChainSize(header.Width, header.Height, header.Levels) != (size_t)info.st_size) {
+		munmap(mapping, info.st_size);
+		return false;
+	}
+	image.Header = header;
+	image.Levels = (const GLubyte*)mapping + sizeof(header);
+	image.Size = info.st_size - sizeof(header);
+	image.Mapping = mapping;
+	image.MappingSize = info.st_size;
+	return true;
+}
+
+/* Mip chain of an image file - from the cache when it is current, else decoded once and written to the cache.
+   On failure error says why, since SOIL's own last result is shared by every thread */
+bool openCachedImage (const std::string& filename, CachedImage& image, std::string& error)
+{
+	image.Mapping = NULL;
+	image.Levels = NULL;
+
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	if (!file.is_open()) {
+		error = "cannot open file";
+		return false;
+	}
+	std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	unsigned long long hash = fnv1a(source);
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.rgba", fnv1a(filename));
+	std::string path = TEXTURE_CACHE_DIR + std::string(name);
+	if (mapTextureCache(path, hash, image))
+		return true;
+
+	// Decode and build the whole chain on the CPU
+	int width, height;
+	unsigned char* pixels = SOIL_load_image_from_memory((const unsigned char*)source.data(), source.size(), &width, &height, 0, SOIL_LOAD_RGBA);
+	if (!pixels) {
+		error = "not a supported image";
+		return false;
+	}
+	TextureCacheHeader header = { TEXTURE_CACHE_MAGIC, TEXTURE_CACHE_VERSION, hash, width, height, 1, 0 };
+	while ((width >> header.Levels) > 0 || (height >> header.Levels) > 0)
+		header.Levels++;
+	std::vector<GLubyte>& chain = image.Memory;
+	chain.resize(mipChainSize(width, height, header.Levels));
+	memcpy(&chain[0], pixels, 4*(size_t)width*height);
+	SOIL_free_image_data(pixels);
+	size_t offset = 0;
+	for (int i = 0; i + 1 < header.Levels; i++) {
+		int w = std::max(1, width >> i), h = std::max(1, height >> i);
+		downsampleRGBA8(&chain[offset], w, h, &chain[offset + 4*(size_t)w*h]);
+		offset += 4*(size_t)w*h;
+	}
+
+	// Write to a temporary file and rename, so no reader ever maps a half written entry
+	mkdir(TEXTURE_CACHE_DIR, 0755);
+	std::string temp = path + ".tmp" + std::to_string((unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()));
+	{
+		std::ofstream out(temp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)&chain[0], chain.size());
+	}
+	if (rename(temp.c_str(), path.c_str()) == 0 && mapTextureCache(path, hash, image)) {
+		std::vector<GLubyte>().swap(chain);
+		return true;
+	}
+	remove(temp.c_str());
+
+	// Cache not writable - use the chain from memory this time
+	image.Header = header;
+	image.Levels = &chain[0];
+	image.Size = chain.size();
+	return true;
+}
+
+void closeCachedImage (CachedImage& image)
+{
+	if (image.Mapping)
+		munmap(image.Mapping, image.MappingSize);
+	image.Mapping = NULL;
+	image.Levels = NULL;
+	std::vector<GLubyte>().swap(image.Memory);
+}
+
+/* Images decoded on worker threads, uploaded on the GL thread through a pixel buffer object */
+struct TextureLoad {
+	std::string Filename;
+	GLuint TextureID; // Shows the placeholder until the upload
+	int Width, Height;
+	const GLubyte* Pixels; // RGBA8 level 0 of Image, NULL if loading failed
+	CachedImage Image;
+	bool Done; // Decoded - set under the loader mutex
+};
+struct TextureLoader {
+	std::vector<std::thread> Workers;
+	std::mutex Mutex; // Guards everything below
+	std::condition_variable Wake;
+	std::deque<TextureLoad*> Queued;
+	std::vector<TextureLoad*> Decoded; // Loads with a texture to upload
+	bool Stop;
+	GLBuffer UploadBuffer; // GL thread only
+} Textures;
+
+void textureWorker ()
+{
+	std::unique_lock<std::mutex> lock(Textures.Mutex);
+	while (true) {
+		Textures.Wake.wait(lock, [] { return Textures.Stop || !Textures.Queued.empty(); });
+		if (Textures.Stop)
+			return;
+		TextureLoad* load = Textures.Queued.front();
+		Textures.Queued.pop_front();
+
+		lock.unlock();
+		// RGBA keeps every row 4 byte aligned for the upload
+		std::string error;
+		if (openCachedImage(load->Filename, load->Image, error)) {
+			load->Pixels = load->Image.Levels;
+			load->Width = load->Image.Header.Width;
+			load->Height = load->Image.Header.Height;
+		}
+		else
+			cout << "Texture loading error: '" << load->Filename << "': " << error << '\n';
+		lock.lock();
+		load->Done = true;
+		if (load->TextureID)
+			Textures.Decoded.push_back(load); // Loads without a texture are owned by the atlas, which polls Done
+	}
 }
 
-void draw3DTexturedObject (struct VAO* vao)
+void initTextureLoader ()
 {
-	// Change the Fill Mode for this object
-	glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
-
-	// Bind the VAO to use
-	glBindVertexArray (vao->VertexArrayID);
+	Textures.Stop = false;
+	Textures.UploadBuffer = genBuffer();
+	unsigned threads = std::max(1u, std::min(4u, std::thread::hardware_concurrency() - 1));
+	for (unsigned i = 0; i < threads; i++)
+		Textures.Workers.push_back(std::thread(textureWorker));
+}
 
-	// Enable Vertex Attribute 0 - 3d Vertices
-	glEnableVertexAttribArray(0);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+void packTextureAtlas();
 
-	// Bind Textures using texture units
-	glBindTexture(GL_TEXTURE_2D, vao->TextureID);
+/* Move decoded images into their textures - call once per frame on the GL thread */
+void pollTextureLoads ()
+{
+	std::vector<TextureLoad*> decoded;
+	{
+		std::lock_guard<std::mutex> lock(Textures.Mutex);
+		decoded.swap(Textures.Decoded);
+	}
 
-	// Enable Vertex Attribute 2 - Texture
-	glEnableVertexAttribArray(2);
-	// Bind the VBO to use
-	glBindBuffer(GL_ARRAY_BUFFER, vao->TextureBuffer);
+	for (size_t i = 0; i < decoded.size(); i++) {
+		TextureLoad* load = decoded[i];
+		if (load->Pixels) {
+			// Copy the mapped chain into a fresh PBO - glTexImage2D then returns without waiting for the transfer
+			const CachedImage& image = load->Image;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, Textures.UploadBuffer);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, image.Size, NULL, GL_STREAM_DRAW);
+			void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, image.Size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			if (mapped) {
+				memcpy(mapped, image.Levels, image.Size);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glsBindTexture(load->TextureID);
+				// Every level comes from the cache, none is generated on the GPU
+				size_t offset = 0;
+				for (int level = 0; level < image.Header.Levels; level++) {
+					int w = std::max(1, load->Width >> level), h = std::max(1, load->Height >> level);
+					glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void*)offset);
+					offset += 4*(size_t)w*h;
+				}
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.Header.Levels - 1);
+				glsBindTexture(0);
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // Later texture uploads read client memory again
+		}
+		closeCachedImage(load->Image); // Unmap the data read from file after creating opengl texture
+		delete load;
+	}
 
-	// Draw the geometry !
-	glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
+	// Atlas pages are packed once all of their images are in
+	packTextureAtlas();
+}
 
-	// Unbind Textures to be safe
-	glBindTexture(GL_TEXTURE_2D, 0);
+void releaseTextureLoader ()
+{
+	{
+		std::lock_guard<std::mutex> lock(Textures.Mutex);
+		Textures.Stop = true;
+	}
+	Textures.Wake.notify_all();
+	for (size_t i = 0; i < Textures.Workers.size(); i++)
+		Textures.Workers[i].join();
+	Textures.Workers.clear();
+
+	// Whatever did not reach its texture - loads without one belong to the atlas
+	for (size_t i = 0; i < Textures.Queued.size(); i++)
+		if (Textures.Queued[i]->TextureID)
+			delete Textures.Queued[i];
+	Textures.Queued.clear();
+	for (size_t i = 0; i < Textures.Decoded.size(); i++) {
+		closeCachedImage(Textures.Decoded[i]->Image);
+		delete Textures.Decoded[i];
+	}
+	Textures.Decoded.clear();
+	Textures.UploadBuffer.reset();
 }
 
-/* Create an OpenGL Texture from an image */
+/* Texture that shows a grey placeholder until the image is decoded and uploaded - returns at once */
 GLuint createTexture (const char* filename)
 {
 	GLuint TextureID;
 	// Generate Texture Buffer
 	glGenTextures(1, &TextureID);
 	// All upcoming GL_TEXTURE_2D operations now have effect on our texture buffer
-	glBindTexture(GL_TEXTURE_2D, TextureID);
+	glsBindTexture(TextureID);
 	// Set our texture parameters
 	// Set texture wrapping to GL_REPEAT
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -313,18 +2156,271 @@ GLuint createTexture (const char* filename)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	// Load image and create OpenGL texture
-	int twidth, theight;
-	unsigned char* image = SOIL_load_image(filename, &twidth, &theight, 0, SOIL_LOAD_RGB);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, twidth, theight, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D); // Generate MipMaps to use
-	SOIL_free_image_data(image); // Free the data read from file after creating opengl texture
-	glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done, so we won't accidentily mess it up
+	// One texel placeholder, complete at every mipmap level
+	const GLubyte placeholder[4] = { 128, 128, 128, 255 };
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glsBindTexture(0); // Unbind texture when done, so we won't accidentily mess it up
+
+	// Decode in the background, the same texture name gets the image later
+	TextureLoad* load = new TextureLoad();
+	load->Filename = filename;
+	load->TextureID = TextureID;
+	{
+		std::lock_guard<std::mutex> lock(Textures.Mutex);
+		Textures.Queued.push_back(load);
+	}
+	Textures.Wake.notify_one();
 
 	return TextureID;
 }
 
 
+/* Sprite images packed into a few large textures, so sprites of one page share a single bind */
+const int ATLAS_PADDING = 2; // Edge texels repeated around every image, so filtering never reads a neighbour
+struct AtlasSprite {
+	GLuint TextureID; // Atlas page
+	GLfloat UV[4]; // (s0,t0,s1,t1) of the image inside the page
+	int Width, Height;
+};
+struct SkylineNode {
+	int X, Y, Width; // Top of the packed area over [X, X+Width)
+};
+struct AtlasPage {
+	GLTexture Texture;
+	int Width, Height; // Height is the limit while packing, then trimmed to the packed area
+	std::vector<SkylineNode> Skyline; // Only while packing
+};
+struct TextureAtlas {
+	std::vector<AtlasPage> Pages;
+	std::map<std::string, AtlasSprite> Sprites; // By file name
+	std::vector<TextureLoad*> Pending; // Queued images, packed together once all are decoded
+} Atlas;
+
+// Lowest position where a w x h rectangle fits on the page skyline, bottom-left rule - false if it does not fit
+bool skylineFind (const AtlasPage& page, int w, int h, int& best_node, int& best_y)
+{
+	best_node = -1;
+	best_y = page.Height;
+	int best_width = page.Width;
+	for (size_t i = 0; i < page.Skyline.size(); i++) {
+		int x = page.Skyline[i].X;
+		if (x + w > page.Width)
+			break;
+		// Resting height over the nodes the rectangle spans
+		int y = 0, remaining = w;
+		for (size_t k = i; remaining > 0; k++) {
+			y = std::max(y, page.Skyline[k].Y);
+			remaining -= page.Skyline[k].Width;
+		}
+		if (y + h > page.Height)
+			continue;
+		if (y < best_y || (y == best_y && page.Skyline[i].Width < best_width)) {
+			best_node = i;
+			best_y = y;
+			best_width = page.Skyline[i].Width;
+		}
+	}
+	return best_node >= 0;
+}
+
+// Raise the skyline over a rectangle placed at node
+void skylineAdd (AtlasPage& page, int node, int w, int h, int y)
+{
+	SkylineNode top = { page.Skyline[node].X, y + h, w };
+	page.Skyline.insert(page.Skyline.begin() + node, top);
+
+	// Cut the nodes now under the rectangle
+	for (size_t i = node + 1; i < page.Skyline.size(); ) {
+		SkylineNode& next = page.Skyline[i];
+		int covered = top.X + top.Width - next.X;
+		if (covered <= 0)
+			break;
+		if (covered < next.Width) {
+			next.X += covered;
+			next.Width -= covered;
+			break;
+		}
+		page.Skyline.erase(page.Skyline.begin() + i);
+	}
+	// Merge neighbours of equal height
+	for (size_t i = 0; i + 1 < page.Skyline.size(); ) {
+		if (page.Skyline[i].Y == page.Skyline[i + 1].Y) {
+			page.Skyline[i].Width += page.Skyline[i + 1].Width;
+			page.Skyline.erase(page.Skyline.begin() + i + 1);
+		}
+		else
+			i++;
+	}
+}
+
+// Copy an image into a page of the given width at (x,y) with its edge texels extruded into the padding
+void atlasBlit (std::vector<GLubyte>& pixels, int width, const TextureLoad& image, int x, int y)
+{
+	for (int row = -ATLAS_PADDING; row < image.Height + ATLAS_PADDING; row++) {
+		int src_row = std::min(std::max(row, 0), image.Height - 1);
+		for (int col = -ATLAS_PADDING; col < image.Width + ATLAS_PADDING; col++) {
+			int src_col = std::min(std::max(col, 0), image.Width - 1);
+			memcpy(&pixels[4*((y + row)*width + x + col)], &image.Pixels[4*(src_row*image.Width + src_col)], 4);
+		}
+	}
+}
+
+/* Start decoding images for the atlas on the texture workers - returns at once, pollTextureLoads packs them */
+void queueAtlasImages (const char* const* filenames, int count)
+{
+	{
+		std::lock_guard<std::mutex> lock(Textures.Mutex);
+		for (int i = 0; i < count; i++) {
+			TextureLoad* load = new TextureLoad(); // No TextureID - owned by the atlas, not uploaded by itself
+			load->Filename = filenames[i];
+			Textures.Queued.push_back(load);
+			Atlas.Pending.push_back(load);
+		}
+	}
+	Textures.Wake.notify_all();
+}
+
+/* Pack and upload the queued images once every one of them is decoded - pages are only as big as their contents */
+void packTextureAtlas ()
+{
+	if (Atlas.Pending.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(Textures.Mutex);
+		for (size_t i = 0; i < Atlas.Pending.size(); i++)
+			if (!Atlas.Pending[i]->Done)
+				return;
+	}
+	std::vector<TextureLoad*> images;
+	images.swap(Atlas.Pending);
+
+	GLint max_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+	// Page width from the widest image and the total area, height grows as needed
+	int widest = 0;
+	double area = 0;
+	for (size_t i = 0; i < images.size(); i++)
+		if (images[i]->Pixels) {
+			widest = std::max(widest, images[i]->Width + 2*ATLAS_PADDING);
+			area += (double)(images[i]->Width + 2*ATLAS_PADDING)*(images[i]->Height + 2*ATLAS_PADDING);
+		}
+	int page_width = 1;
+	while (page_width < std::max(widest, (int)ceil(sqrt(area))))
+		page_width *= 2;
+	page_width = std::min(page_width, (int)max_size);
+
+	// Tallest first keeps the skyline flat
+	std::sort(images.begin(), images.end(), [] (const TextureLoad* a, const TextureLoad* b) { return a->Height > b->Height; });
+	struct Placement { const TextureLoad* Image; size_t Page; int X, Y; };
+	std::vector<Placement> placements;
+	size_t first_page = Atlas.Pages.size();
+	for (size_t i = 0; i < images.size(); i++) {
+		const TextureLoad& image = *images[i];
+		int w = image.Width + 2*ATLAS_PADDING, h = image.Height + 2*ATLAS_PADDING;
+		if (!image.Pixels)
+			continue; // The worker already reported why
+		if (w > page_width || h > max_size) {
+			cout << "Error: " << image.Filename << " is larger than an atlas page" << '\n';
+			continue;
+		}
+
+		// First page of this pack with room, or a new one
+		size_t p;
+		int node = -1, y = 0;
+		for (p = first_page; p < Atlas.Pages.size(); p++)
+			if (skylineFind(Atlas.Pages[p], w, h, node, y))
+				break;
+		if (p == Atlas.Pages.size()) {
+			Atlas.Pages.push_back(AtlasPage());
+			AtlasPage& page = Atlas.Pages.back();
+			page.Width = page_width;
+			page.Height = max_size;
+			SkylineNode ground = { 0, 0, page_width };
+			page.Skyline.push_back(ground);
+			skylineFind(page, w, h, node, y);
+		}
+		AtlasPage& page = Atlas.Pages[p];
+		Placement placement = { &image, p, page.Skyline[node].X + ATLAS_PADDING, y + ATLAS_PADDING };
+		placements.push_back(placement);
+		skylineAdd(page, node, w, h, y);
+	}
+
+	// Trim every new page to its highest image, then fill and upload it
+	for (size_t p = first_page; p < Atlas.Pages.size(); p++) {
+		AtlasPage& page = Atlas.Pages[p];
+		int height = 0;
+		for (size_t i = 0; i < page.Skyline.size(); i++)
+			height = std::max(height, page.Skyline[i].Y);
+		page.Height = height;
+		std::vector<SkylineNode>().swap(page.Skyline);
+
+		std::vector<GLubyte> pixels(4*(size_t)page.Width*page.Height, 0);
+		for (size_t i = 0; i < placements.size(); i++)
+			if (placements[i].Page == p)
+				atlasBlit(pixels, page.Width, *placements[i].Image, placements[i].X, placements[i].Y);
+
+		page.Texture = genTexture();
+		glsBindTexture(page.Texture);
+		// Pages cannot repeat, and mipmaps stop at the padding
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1); // Padding of 2 texels covers one level down
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, page.Width, page.Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glsBindTexture(0);
+	}
+
+	for (size_t i = 0; i < placements.size(); i++) {
+		const Placement& placement = placements[i];
+		const AtlasPage& page = Atlas.Pages[placement.Page];
+		AtlasSprite& sprite = Atlas.Sprites[placement.Image->Filename];
+		sprite.TextureID = page.Texture;
+		sprite.Width = placement.Image->Width;
+		sprite.Height = placement.Image->Height;
+		sprite.UV[0] = (GLfloat)placement.X / page.Width;
+		sprite.UV[1] = (GLfloat)placement.Y / page.Height;
+		sprite.UV[2] = (GLfloat)(placement.X + sprite.Width) / page.Width;
+		sprite.UV[3] = (GLfloat)(placement.Y + sprite.Height) / page.Height;
+	}
+	for (size_t i = 0; i < images.size(); i++) {
+		closeCachedImage(images[i]->Image);
+		delete images[i];
+	}
+}
+
+/* Sprite of a packed image, or NULL if it is not in the atlas (yet) */
+const AtlasSprite* atlasSprite (const char* filename)
+{
+	std::map<std::string, AtlasSprite>::const_iterator it = Atlas.Sprites.find(filename);
+	return it == Atlas.Sprites.end() ? NULL : &it->second;
+}
+
+/* Textured mesh whose texture coordinates (0..1) address the sprite's image inside its atlas page */
+struct VAO* create3DAtlasObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* texture_buffer_data, const AtlasSprite& sprite, GLenum fill_mode=GL_FILL)
+{
+	std::vector<GLfloat> uv(2*numVertices);
+	for (int i=0; i<numVertices; i++) {
+		uv[2*i] = sprite.UV[0] + texture_buffer_data[2*i]*(sprite.UV[2] - sprite.UV[0]);
+		uv[2*i + 1] = sprite.UV[1] + texture_buffer_data[2*i + 1]*(sprite.UV[3] - sprite.UV[1]);
+	}
+	return create3DTexturedObject(primitive_mode, numVertices, vertex_buffer_data, &uv[0], sprite.TextureID, fill_mode);
+}
+
+/* Must run after releaseTextureLoader, so no worker still decodes a pending image */
+void releaseTextureAtlas ()
+{
+	for (size_t i = 0; i < Atlas.Pending.size(); i++) {
+		closeCachedImage(Atlas.Pending[i]->Image);
+		delete Atlas.Pending[i];
+	}
+	Atlas.Pending.clear();
+	Atlas.Pages.clear();
+	Atlas.Sprites.clear();
+}
+
 /**************************
  * Customizable functions *
  **************************/
@@ -348,6 +2444,7 @@ float screen_shift=0,screen_shift_y=0;
 float camera_zoom=1.05;
 double angle_c=10,speed_of_canon_intial=0;
 int a_pressed=0,w_pressed=0,s_pressed=0,d_pressed=0,c_pressed=0;
+int show_render_stats=0; // toggled with P
 VAO *triangle, *circle1, *circle2, *half_circle, *rectangle, *bg_circle, *bg_ground, *bg_left, *bg_bottom, *speed_rect;
 VAO *bg_speed;
 double xmousePos=0,ymousePos=0,score=0;
@@ -357,6 +2454,40 @@ double canon_x_position=0,canon_y_position=51,canon_start_time=0,canon_velocity=
 double canon_x_initial_position=0,canon_y_initial_position=0,canon_x_velocity=0,canon_y_velocity=0;
 int canon_x_direction=1;
 float width=1350,height=720;
+int fb_width=1350,fb_height=720; // framebuffer size in pixels, can differ from the window on retina displays
+// Part of the world visible through the camera - recomputed whenever the projection changes
+struct ViewCull {
+    glm::mat4 Projection;
+    float MinX,MinY,MaxX,MaxY;
+    int Drawn,Culled; // renderables submitted and skipped this frame
+    int LastDrawn,LastCulled;
+} Cull;
+void beginCulling()
+{
+    Cull.LastDrawn=Cull.Drawn;
+    Cull.LastCulled=Cull.Culled;
+    Cull.Drawn=Cull.Culled=0;
+}
+// True if the world space box overlaps the view - counted as drawn or culled
+bool inView(double minx,double miny,double maxx,double maxy)
+{
+    if (Cull.Projection!=Matrices.projection)
+    {
+        glm::mat4 inverseVP=glm::inverse(Matrices.projection*Matrices.view);
+        glm::vec4 lo=inverseVP*glm::vec4(-1,-1,0,1),hi=inverseVP*glm::vec4(1,1,0,1);
+        Cull.MinX=std::min(lo.x,hi.x);
+        Cull.MaxX=std::max(lo.x,hi.x);
+        Cull.MinY=std::min(lo.y,hi.y);
+        Cull.MaxY=std::max(lo.y,hi.y);
+        Cull.Projection=Matrices.projection;
+    }
+    bool visible=maxx>=Cull.MinX&&minx<=Cull.MaxX&&maxy>=Cull.MinY&&miny<=Cull.MaxY;
+    if (visible)
+        Cull.Drawn++;
+    else
+        Cull.Culled++;
+    return visible;
+}
 double coefficient_of_collision_with_walls=0.4,e=0.5;//e for collision
 double friction=0.7;
 double objects[100][17];
@@ -368,23 +2499,21 @@ int no_of_objects=3;//when ever u change this change the below line
 VAO *objects_def[3];
 double piggy_pos[3][3],no_of_piggy=3,radius_of_piggy=30,no_of_piggy_hit=0;
 double r=1; //coefficient_of_collision
-VAO *piggy_head,*piggy_eye,*piggy_ear,*piggy_big_nose,*piggy_small_nose,*piggy_big_eye,*cloud;
-VAO *score_ver,*score_hor;
-double a[10][7];
+VAO *piggy_mesh,*cloud;
+VAO *unit_disc,*unit_half_disc; // instanced meshes, radius 1 - the finest level of round_disc and round_half_disc
+// Levels of detail of the round meshes, coarse to fine - full circle segment counts
+const int ROUND_LODS=4;
+const int round_segments[ROUND_LODS]={8,16,32,64};
+struct RoundMesh {
+    VAO* Levels[ROUND_LODS];
+} round_disc,round_half_disc;
+vector<Instance> disc_instances,half_disc_instances,cloud_instances;
+VAO *shape_quad; // unit quad for the SDF shape shader
+vector<ShapeInstance> shape_instances;
+vector<CompositeInstance> piggy_instances; // Damage is piggy_pos[i][2]
+const glm::vec3 coin_color(1.0,0.83,0.2),object_color(1,1,1),cloud_color(1,1,1);
+const glm::vec3 piggy_head_color(1.0,0.4,0.6),piggy_ear_color(1,0,0.33),piggy_black(0,0,0),piggy_white(1,1,1);
 int no_of_collisions_allowed=60;
-void intialize_a()
-{
-    a[0][0]=1;a[0][1]=1;a[0][2]=1;a[0][3]=1;a[0][4]=1;a[0][5]=1;a[0][6]=0;
-    a[1][0]=0;a[1][1]=1;a[1][2]=1;a[1][3]=0;a[1][4]=0;a[1][5]=0;a[1][6]=0;
-    a[2][0]=1;a[2][1]=1;a[2][2]=0;a[2][3]=1;a[2][4]=1;a[2][5]=0;a[2][6]=1;
-    a[3][0]=1;a[3][1]=1;a[3][2]=1;a[3][3]=1;a[3][4]=0;a[3][5]=0;a[3][6]=1;
-    a[4][0]=0;a[4][1]=1;a[4][2]=1;a[4][3]=0;a[4][4]=0;a[4][5]=1;a[4][6]=1;
-    a[5][0]=1;a[5][1]=0;a[5][2]=1;a[5][3]=1;a[5][4]=0;a[5][5]=1;a[5][6]=1;
-    a[6][0]=1;a[6][1]=0;a[6][2]=1;a[6][3]=1;a[6][4]=1;a[6][5]=1;a[6][6]=1;
-    a[7][0]=1;a[7][1]=1;a[7][2]=1;a[7][3]=0;a[7][4]=0;a[7][5]=0;a[7][6]=0;
-    a[8][0]=1;a[8][1]=1;a[8][2]=1;a[8][3]=1;a[8][4]=1;a[8][5]=1;a[8][6]=1;
-    a[9][0]=1;a[9][1]=1;a[9][2]=1;a[9][3]=1;a[9][4]=0;a[9][5]=1;a[9][6]=1;
-}
                     /*
                         0 x position
                         1 y position
@@ -414,6 +2543,143 @@ VAO* createSector(float R,int parts,double clr[6][3])
   GLfloat color_buffer_data[]={clr[0][0],clr[0][1],clr[0][2],clr[1][0],clr[1][1],clr[1][2],clr[2][0],clr[2][1],clr[2][2]};
   return create3DObject(GL_TRIANGLES,3,vertex_buffer_data,color_buffer_data,GL_FILL);
 }
+// Filled disc (or arc of a disc from A1 to A2 degrees) as one triangle fan with the given number of segments
+VAO* createDisc(float R,int segments,double clr[6][3],float A1=0,float A2=360)
+{
+  vector<GLfloat> vertex_buffer_data,color_buffer_data;
+  vertex_buffer_data.reserve(3*(segments+2));
+  color_buffer_data.reserve(3*(segments+2));
+  for (int i = -1; i <= segments; i++)
+  {
+    if (i==-1)
+    {
+      vertex_buffer_data.push_back(0);
+      vertex_buffer_data.push_back(0);
+    }
+    else
+    {
+      float A=A1+(A2-A1)*i/segments;
+      vertex_buffer_data.push_back(R*cos(D2R(A)));
+      vertex_buffer_data.push_back(R*sin(D2R(A)));
+    }
+    vertex_buffer_data.push_back(0);
+    int c=(i==-1)?0:1+i%2;
+    for (int k = 0; k < 3; k++)
+      color_buffer_data.push_back(clr[c][k]);
+  }
+  return create3DObject(GL_TRIANGLE_FAN,segments+2,&vertex_buffer_data[0],&color_buffer_data[0],GL_FILL);
+}
+void addInstance(vector<Instance>& instances,double x,double y,double scale,glm::vec3 color)
+{
+  if (!inView(x-scale,y-scale,x+scale,y+scale))
+    return;
+  Instance instance;
+  instance.Translate[0]=x;
+  instance.Translate[1]=y;
+  instance.Scale=scale;
+  instance.Color=packColor(color[0],color[1],color[2]);
+  instances.push_back(instance);
+}
+// Regular polygon with the same orientation as createSector(R,sides) drawn at every 360/sides degrees
+void addShape(double x,double y,double R,int sides,glm::vec3 color)
+{
+  if (!inView(x-R,y-R,x+R,y+R))
+    return;
+  ShapeInstance shape;
+  shape.Center[0]=x;
+  shape.Center[1]=y;
+  shape.Radius=R;
+  shape.Color=packColor(color[0],color[1],color[2]);
+  shape.Sides=sides;
+  shape.Rotation=(sides>0)?M_PI/sides:0;
+  shape_instances.push_back(shape);
+}
+void drawShapes(RenderLayer layer)
+{
+    RenderCommand cmd = RenderCommand();
+    cmd.Kind=CMD_SHAPES;
+    cmd.Program=shapeProgramID;
+    cmd.Mesh=shape_quad;
+    cmd.Shapes=&shape_instances;
+    submitCommand(layer,cmd);
+}
+void drawComposites(VAO* obj,const vector<CompositeInstance>& instances,RenderLayer layer)
+{
+    RenderCommand cmd = RenderCommand();
+    cmd.Kind=CMD_COMPOSITE;
+    cmd.Program=compositeProgramID;
+    cmd.Mesh=obj;
+    cmd.Composites=&instances;
+    submitCommand(layer,cmd);
+}
+// Hexagonal part of the piggy mesh, oriented like addShape(x,y,R,6,color)
+ShapePart piggyPart(double x,double y,double R,glm::vec3 color,double threshold)
+{
+  ShapePart part;
+  part.Center[0]=x;
+  part.Center[1]=y;
+  part.Radius=R;
+  part.Color[0]=color[0];
+  part.Color[1]=color[1];
+  part.Color[2]=color[2];
+  part.Sides=6;
+  part.Rotation=M_PI/6;
+  part.Threshold=threshold;
+  return part;
+}
+// Whole piggy as one mesh - the big black eyes appear at 1 and 2 hits
+VAO* createPiggy()
+{
+  ShapePart parts[]={
+    piggyPart(-24,15,8,piggy_ear_color,0),
+    piggyPart(24,15,8,piggy_ear_color,0),
+    piggyPart(0,0,radius_of_piggy,piggy_head_color,0),
+    piggyPart(-12,12,7,piggy_black,1),
+    piggyPart(12,12,7,piggy_black,2),
+    piggyPart(12,12,5,piggy_white,0),
+    piggyPart(-12,12,5,piggy_white,0),
+    piggyPart(0,-8,10,piggy_black,0),
+    piggyPart(-4,-8,3,piggy_white,0),
+    piggyPart(4,-8,3,piggy_white,0)
+  };
+  return createCompositeShape(sizeof(parts)/sizeof(parts[0]),parts);
+}
+// Coarsest level whose chords stay within half a pixel of a circle with this on-screen radius
+int roundLOD(double pixel_radius)
+{
+    for (int l = 0; l < ROUND_LODS-1; l++)
+        if (pixel_radius*(1-cos(M_PI/round_segments[l]))<=0.5)
+            return l;
+    return ROUND_LODS-1;
+}
+// Instances are regrouped by level in place, one instanced draw per level in use
+void drawInstances(const RoundMesh& mesh,vector<Instance>& instances,RenderLayer layer)
+{
+    static vector<Instance> levels[ROUND_LODS];
+    // Ortho projection - world units to framebuffer pixels
+    double pixels_per_unit=Matrices.projection[0][0]*fb_width/2;
+    for (int l = 0; l < ROUND_LODS; l++)
+        levels[l].clear();
+    for (size_t i = 0; i < instances.size(); i++)
+        levels[roundLOD(instances[i].Scale*pixels_per_unit)].push_back(instances[i]);
+    instances.clear();
+    for (int l = 0; l < ROUND_LODS; l++)
+        instances.insert(instances.end(),levels[l].begin(),levels[l].end());
+    size_t first=0;
+    for (int l = 0; l < ROUND_LODS; l++)
+    {
+        if (levels[l].empty())
+            continue;
+        RenderCommand cmd = RenderCommand();
+        cmd.Kind=CMD_INSTANCED;
+        cmd.Program=instancedProgramID;
+        cmd.Mesh=mesh.Levels[l];
+        cmd.Instances=&instances[first];
+        cmd.NumInstances=levels[l].size();
+        submitCommand(layer,cmd);
+        first+=levels[l].size();
+    }
+}
 VAO* createtriangle()
 {
   const GLfloat vertex_buffer_data [] = {
@@ -431,6 +2697,13 @@ VAO* createtriangle()
 
 VAO* createRectangle(double length, double breadth, double clr[6][3])
 {
+  // Single color rectangles need no vertices at all
+  bool flat=true;
+  for (int i = 1; i < 6; i++)
+    for (int k = 0; k < 3; k++)
+      flat=flat&&clr[i][k]==clr[0][k];
+  if (flat)
+    return createQuad(length,breadth,clr[0][0],clr[0][1],clr[0][2]);
   // GL3 accepts only Triangles. Quads are not supported
   const GLfloat vertex_buffer_data [] = {
     0,0,0, // vertex 1
@@ -524,6 +2797,10 @@ void keyboardChar (GLFWwindow* window, unsigned int key)
 		case 'Q':
 		case 'q':
             quit(window);
+            break;
+		case 'P':
+		case 'p':
+            show_render_stats=!show_render_stats;
             break;
 		default:
 			break;
@@ -566,6 +2843,8 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 
 	GLfloat fov = 90.0f;
 	glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+    fb_width=fbwidth;
+    fb_height=fbheight;
     Matrices.projection = glm::ortho((0.0f)*1.0f, width*1.0f, 0.0f, height*1.0f, 0.1f, 500.0f);
 }
 double distance(double x1,double y1, double x2, double y2)
@@ -847,18 +3126,43 @@ void checkcollision()
         }    
     }
 }
-void drawobject(VAO* obj,glm::vec3 trans,float angle,glm::vec3 rotat)
+// Everything lies in the XY plane, so rotat only picks the direction of the rotation about z
+void drawobject(VAO* obj,glm::vec3 trans,float angle,glm::vec3 rotat,glm::vec3 scale,RenderLayer layer=LAYER_WORLD)
+{
+    float theta=(rotat.z<0)?-D2R(formatAngle(angle)):D2R(formatAngle(angle));
+    glm::mat3 model=model2D(glm::vec2(trans.x,trans.y),theta,glm::vec2(scale.x,scale.y));
+    // World space box around the transformed corners of the mesh box
+    GLfloat bounds[4];
+    resetBounds(bounds);
+    for (int i = 0; i < 4; i++)
+    {
+        glm::vec3 corner=model*glm::vec3(obj->Bounds[(i&1)?2:0],obj->Bounds[(i&2)?3:1],1);
+        growBounds(bounds,corner.x,corner.y);
+    }
+    if (!inView(bounds[0],bounds[1],bounds[2],bounds[3]))
+        return;
+    if (obj->IsQuad)
+    {
+        QuadInstance quad;
+        quad.Translate[0]=trans.x;
+        quad.Translate[1]=trans.y;
+        quad.Size[0]=obj->QuadSize[0]*scale.x;
+        quad.Size[1]=obj->QuadSize[1]*scale.y;
+        quad.Rotation=theta;
+        quad.Color=obj->FlatColor;
+        submitQuad(layer,quad);
+        return;
+    }
+    RenderCommand cmd = RenderCommand();
+    cmd.Kind=CMD_SPRITE;
+    cmd.Program=programID;
+    cmd.Mesh=obj;
+    cmd.Model=model;
+    submitCommand(layer,cmd);
+}
+void drawobject(VAO* obj,glm::vec3 trans,float angle,glm::vec3 rotat,RenderLayer layer=LAYER_WORLD)
 {
-    Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0));
-    glm::mat4 VP = Matrices.projection * Matrices.view;
-    glm::mat4 MVP;  // MVP = Projection * View * Model
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translatemat = glm::translate(trans);
-    glm::mat4 rotatemat = glm::rotate(D2R(formatAngle(angle)), rotat);
-    Matrices.model *= (translatemat * rotatemat);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(obj);
+    drawobject(obj,trans,angle,rotat,glm::vec3(1,1,1),layer);
 }
 
 void intialize_objects()
@@ -994,6 +3298,236 @@ void background()
         clr[i][2]=0;
     }
     bg_speed=createRectangle(width/3,23,clr);
+    for (int i = 0; i < 6;i++)
+    {
+        clr[i][0]=1;
+        clr[i][1]=0;
+        clr[i][2]=0;
+    }
+    speed_rect=createRectangle(1,15,clr);
+}
+
+/* Part of the scene rendered once into a texture and reused until it changes or the camera moves */
+struct LayerCache {
+    GLFramebuffer FramebufferID;
+    GLTexture TextureID;
+    GLRenderbuffer DepthBufferID;
+    VAO* Quad; // textured quad covering the whole viewport
+    bool Valid;
+    bool Overlay; // Cleared to transparent and blended over the frame, instead of covering it
+    // Camera the texture was rendered for - projection covers screen_shift, screen_shift_y and camera_zoom
+    glm::mat4 Projection;
+    int Width,Height;
+    RenderQueue Queue; // Commands of the offscreen pass
+};
+LayerCache StaticLayer; // Objects that never move
+LayerCache HudLayer; // Score, label and power bar
+
+// Render every cached layer again on its next use
+void invalidateLayerCaches()
+{
+    StaticLayer.Valid=HudLayer.Valid=false;
+}
+
+/* HUD values the cached texture shows - it is re-rendered only when one of them is dirty */
+struct HudState {
+    int Score;
+    double Power; // speed_of_canon_intial
+} Hud;
+
+void initLayerCache(LayerCache& layer, bool overlay)
+{
+    layer.Overlay=overlay;
+    layer.FramebufferID=genFramebuffer();
+    layer.TextureID=genTexture();
+    layer.DepthBufferID=genRenderbuffer();
+    glsBindTexture(layer.TextureID);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glsBindTexture(0);
+    // Unit quad, stretched over the visible part of the world when drawn
+    const GLfloat vertex_buffer_data[]={0,0,0, 1,0,0, 1,1,0, 0,0,0, 0,1,0, 1,1,0};
+    const GLfloat texture_buffer_data[]={0,0, 1,0, 1,1, 0,0, 0,1, 1,1};
+    layer.Quad=create3DTexturedObject(GL_TRIANGLES,6,vertex_buffer_data,texture_buffer_data,layer.TextureID);
+    layer.Valid=false;
+}
+
+void releaseLayerCache(LayerCache& layer)
+{
+    layer.FramebufferID.reset();
+    layer.TextureID.reset();
+    layer.DepthBufferID.reset();
+    layer.Valid=false;
+}
+
+// True if the texture no longer matches the camera or the framebuffer
+bool layerCacheStale(const LayerCache& layer)
+{
+    return !layer.Valid || layer.Projection!=Matrices.projection || layer.Width!=fb_width || layer.Height!=fb_height;
+}
+
+/* Redirect rendering and submissions into the layer's texture - overlays are cleared to transparent, others to the scene color */
+void beginLayerCache(LayerCache& layer)
+{
+    if (layer.Width!=fb_width || layer.Height!=fb_height)
+    {
+        glsBindTexture(layer.TextureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, fb_width, fb_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glsBindTexture(0);
+        glBindRenderbuffer(GL_RENDERBUFFER,layer.DepthBufferID);
+        glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH_COMPONENT24,fb_width,fb_height);
+        glBindFramebuffer(GL_FRAMEBUFFER,layer.FramebufferID);
+        glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_TEXTURE_2D,layer.TextureID,0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,layer.DepthBufferID);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER)!=GL_FRAMEBUFFER_COMPLETE)
+            cout << "Error: layer cache framebuffer is incomplete" << endl;
+        layer.Width=fb_width;
+        layer.Height=fb_height;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER,layer.FramebufferID);
+    if (layer.Overlay)
+    {
+        // Premultiplied alpha needs zero color where nothing is drawn, the scene color would be added to the frame
+        GLfloat scene[4];
+        glGetFloatv(GL_COLOR_CLEAR_VALUE,scene);
+        glClearColor(0,0,0,0);
+        glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glClearColor(scene[0],scene[1],scene[2],scene[3]);
+    }
+    else
+        glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // Offscreen pass with its own queue, so nothing of the frame being built leaks into the texture
+    SubmitQueue=&layer.Queue;
+}
+
+/* Render what was submitted since beginLayerCache and return to the frame */
+void endLayerCache(LayerCache& layer)
+{
+    SubmitQueue=&FrameQueue;
+    executeRenderQueue(layer.Queue);
+    glBindFramebuffer(GL_FRAMEBUFFER,0);
+    layer.Projection=Matrices.projection;
+    layer.Valid=true;
+}
+
+/* Queue the layer's texture as one quad over the view - overlays are blended */
+void submitLayerCache(const LayerCache& layer, RenderLayer target)
+{
+    // Corners of the view in world space
+    glm::mat4 inverseVP = glm::inverse(Matrices.VP);
+    glm::vec4 lo = inverseVP * glm::vec4(-1,-1,0,1), hi = inverseVP * glm::vec4(1,1,0,1);
+    RenderCommand cmd = RenderCommand();
+    cmd.Kind=CMD_TEXTURED;
+    cmd.Program=textureProgramID;
+    cmd.Mesh=layer.Quad;
+    cmd.Model=model2D(glm::vec2(lo.x,lo.y),0,glm::vec2(hi.x-lo.x,hi.y-lo.y));
+    cmd.Blend=layer.Overlay;
+    submitCommand(target,cmd);
+}
+
+/* Backdrop images packed into the texture atlas - their meshes are built once the atlas has them */
+const char* backdrop_images[]={"beach2.png","beach.png"};
+const int no_of_backdrops=2;
+double backdrop_pos[2][2]={{15,200},{527,200}}; // Side by side on the ground
+VAO* backdrop[2];
+
+// Build the meshes of backdrops whose images were just packed - true if any was, the static layer must show it
+bool createBackdrops()
+{
+    bool created=false;
+    for (int i = 0; i < no_of_backdrops; ++i)
+    {
+        if (backdrop[i])
+            continue;
+        const AtlasSprite* sprite=atlasSprite(backdrop_images[i]);
+        if (!sprite)
+            continue;
+        GLfloat w=sprite->Width,h=sprite->Height;
+        const GLfloat vertex_buffer_data[]={0,0,0, w,0,0, w,h,0, 0,0,0, 0,h,0, w,h,0};
+        const GLfloat texture_buffer_data[]={0,0, 1,0, 1,1, 0,0, 0,1, 1,1};
+        backdrop[i]=create3DAtlasObject(GL_TRIANGLES,6,vertex_buffer_data,texture_buffer_data,*sprite);
+        created=true;
+    }
+    return created;
+}
+
+void drawStaticObjects()
+{
+    // Textured meshes sort first in the layer, so the backdrops end up behind everything else
+    for (int i = 0; i < no_of_backdrops; ++i)
+    {
+        if (!backdrop[i])
+            continue;
+        RenderCommand cmd = RenderCommand();
+        cmd.Kind=CMD_TEXTURED;
+        cmd.Program=textureProgramID;
+        cmd.Mesh=backdrop[i];
+        cmd.Model=model2D(glm::vec2(backdrop_pos[i][0],backdrop_pos[i][1]),0,glm::vec2(1,1));
+        submitCommand(LAYER_BACKGROUND,cmd);
+    }
+    drawobject(bg_ground,glm::vec3(0,0,0),0,glm::vec3(0,0,1),LAYER_BACKGROUND);
+    drawobject(bg_left,glm::vec3(0,0,0),0,glm::vec3(0,0,1),LAYER_BACKGROUND);
+    drawobject(bg_left,glm::vec3(width-15,0,0),0,glm::vec3(0,0,1),LAYER_BACKGROUND);
+    drawobject(bg_bottom,glm::vec3(0,0,0),0,glm::vec3(0,0,1),LAYER_BACKGROUND);
+    drawobject(bg_bottom,glm::vec3(0,height-18,0),0,glm::vec3(0,0,1),LAYER_BACKGROUND);
+    drawobject(bg_bottom,glm::vec3(0,height-60,0),0,glm::vec3(0,0,1),LAYER_BACKGROUND);
+    for (int i = 0; i < no_of_fixed_objects; ++i)
+        drawobject(fixed_object[i],glm::vec3(fixe[i][0],fixe[i][1],0),0,glm::vec3(0,0,1),LAYER_BACKGROUND);
+    cloud_instances.clear();
+    addInstance(cloud_instances,800,550,30,cloud_color);
+    addInstance(cloud_instances,860,550,30,cloud_color);
+    addInstance(cloud_instances,920,550,30,cloud_color);
+    addInstance(cloud_instances,830,555,30,cloud_color);
+    addInstance(cloud_instances,880,555,30,cloud_color);
+    addInstance(cloud_instances,860,570,30,cloud_color);
+    drawInstances(round_half_disc,cloud_instances,LAYER_BACKGROUND);
+}
+
+/* Re-render the static layer if the camera or framebuffer changed, then queue it as one quad */
+void drawStaticLayer()
+{
+    if (layerCacheStale(StaticLayer))
+    {
+        beginLayerCache(StaticLayer);
+        drawStaticObjects();
+        endLayerCache(StaticLayer);
+    }
+    submitLayerCache(StaticLayer,LAYER_BACKGROUND);
+}
+
+void drawHudObjects()
+{
+    drawobject(bg_speed,glm::vec3(18,height-44,0),0,glm::vec3(0,0,1),LAYER_HUD);
+    // Unit length bar stretched to the current power
+    drawobject(speed_rect,glm::vec3(18,height-40,0),0,glm::vec3(0,0,1),glm::vec3(Hud.Power/3,1,1),LAYER_HUD);
+    submitNumber(LAYER_HUD,Hud.Score,width-width/10,height-height/40,glm::vec3(1,0,0));
+    submitText(LAYER_TEXT,"SCORE:",width*8/11,height*16/17,25,glm::vec3(0,0,0));
+}
+
+/* Re-render the HUD only when the score, power or framebuffer size changed, then blend it over the frame */
+void drawHudLayer()
+{
+    bool score_dirty=Hud.Score!=(int)score;
+    bool power_dirty=Hud.Power!=speed_of_canon_intial;
+    // Laid out in screen space, so panning and zooming never make it stale
+    bool size_dirty=!HudLayer.Valid || HudLayer.Width!=fb_width || HudLayer.Height!=fb_height;
+    if (score_dirty || power_dirty || size_dirty)
+    {
+        Hud.Score=score;
+        Hud.Power=speed_of_canon_intial;
+        // Render with the unpanned, unzoomed camera - the texture is then stretched over the view as is
+        glm::mat4 world_projection=Matrices.projection;
+        Matrices.projection=glm::ortho(0.0f, width*1.0f, 0.0f, height*1.0f, 0.1f, 500.0f);
+        updateCamera();
+        beginLayerCache(HudLayer);
+        drawHudObjects();
+        endLayerCache(HudLayer);
+        Matrices.projection=world_projection;
+        updateCamera();
+    }
+    submitLayerCache(HudLayer,LAYER_HUD);
 }
 /*
 void draw ()
@@ -1154,14 +3688,10 @@ GLFWwindow* initGLFW (int width, int height)
 }
 void draw()
 {
+    glsBeginFrame();
+    beginCulling();
+    streamNextSegment(); // Fences last frame's data, and waits if the GPU is a full ring behind
     set_canon_position(canon_x_position,canon_y_position,canon_y_velocity*air_friction,canon_x_velocity*air_friction,0,0,canon_x_velocity*air_friction,canon_y_velocity*air_friction);
-    double clr[6][3];
-    for (int i = 0; i < 6;i++)
-    {
-        clr[i][0]=1;
-        clr[i][1]=0;
-        clr[i][2]=0;
-    }
     if (w_pressed==1)
     {
         angle_c+=5;
@@ -1186,31 +3716,14 @@ void draw()
         if (speed_of_canon_intial<=0)
             speed_of_canon_intial=0;
     }
-    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glUseProgram (programID);
-    drawobject(bg_ground,glm::vec3(0,0,0),0,glm::vec3(0,0,1));
-    drawobject(bg_left,glm::vec3(0,0,0),0,glm::vec3(0,0,1));
-    drawobject(bg_left,glm::vec3(width-15,0,0),0,glm::vec3(0,0,1));
-    drawobject(bg_bottom,glm::vec3(0,0,0),0,glm::vec3(0,0,1));
-    drawobject(bg_bottom,glm::vec3(0,height-18,0),0,glm::vec3(0,0,1));
-    drawobject(bg_bottom,glm::vec3(0,height-60,0),0,glm::vec3(0,0,1));
-    for (int i = 0; i <=180;i+=6)
-        drawobject(cloud,glm::vec3(800,550,0),i,glm::vec3(0,0,1));    
-    for (int i = 0; i <=180;i+=6)
-        drawobject(cloud,glm::vec3(860,550,0),i,glm::vec3(0,0,1));    
-    for (int i = 0; i <=180;i+=6)
-        drawobject(cloud,glm::vec3(920,550,0),i,glm::vec3(0,0,1));    
-    for (int i = 0; i <=180;i+=6)
-        drawobject(cloud,glm::vec3(830,555,0),i,glm::vec3(0,0,1));    
-    for (int i = 0; i <=180;i+=6)
-        drawobject(cloud,glm::vec3(880,555,0),i,glm::vec3(0,0,1));    
-    for (int i = 0; i <=180;i+=6)
-        drawobject(cloud,glm::vec3(860,570,0),i,glm::vec3(0,0,1));     
+    disc_instances.clear();
+    half_disc_instances.clear();
+    shape_instances.clear();
+    piggy_instances.clear();
     if (right_button_Pressed==1)
-        drawobject(rectangle,glm::vec3(55,50,0),atan((720-ymousePos)/xmousePos) * 180/M_PI,glm::vec3(0,0,1));
+        drawobject(rectangle,glm::vec3(55,50,0),atan((720-ymousePos)/xmousePos) * 180/M_PI,glm::vec3(0,0,1),LAYER_PROPS);
     else
-        drawobject(rectangle,glm::vec3(55,50,0),angle_c,glm::vec3(0,0,1));
-    drawobject(bg_speed,glm::vec3(18,height-44,0),0,glm::vec3(0,0,1));
+        drawobject(rectangle,glm::vec3(55,50,0),angle_c,glm::vec3(0,0,1),LAYER_PROPS);
     if(left_button_Pressed==0&&right_button_Pressed==1)
     {
         speed_of_canon_intial=sqrt((xmousePos-55)*(xmousePos-55)+(720-ymousePos)*(720-ymousePos));
@@ -1243,48 +3756,24 @@ void draw()
         float diff = width-width/camera_zoom;
         Matrices.projection = glm::ortho((0.0f+diff+screen_shift)*1.0f, (width-diff+screen_shift)*1.0f, (0.0f+diff-screen_shift_y)*1.0f, (height-diff-screen_shift_y)*1.0f, 0.1f, 500.0f);
     }
-    speed_rect = createRectangle(speed_of_canon_intial/3,15,clr);
-    drawobject(speed_rect,glm::vec3(18,height-40,0),0,glm::vec3(0,0,1));
-    for (int i = 0; i < 360; ++i)
-      drawobject(circle1,glm::vec3(30,40,0),i,glm::vec3(0,0,1));
-    for (int i = 0; i < 360; ++i)
-      drawobject(circle1,glm::vec3(80,40,0),i,glm::vec3(0,0,1));
-    for (int i = 0; i <=180; ++i)
-        drawobject(half_circle,glm::vec3(55,50,0),i,glm::vec3(0,0,1));
+    addInstance(disc_instances,30,40,radius_of_canon,coin_color);
+    addInstance(disc_instances,80,40,radius_of_canon,coin_color);
+    addInstance(half_disc_instances,55,50,40,cloud_color); // cannon base, in front of the barrel and behind the wheels
     for (int i = 0; i < no_of_piggy;i++)
     {
-        if(piggy_pos[i][2]<=2)
+        double x=piggy_pos[i][0],y=piggy_pos[i][1];
+        if(piggy_pos[i][2]<=2&&inView(x+piggy_mesh->Bounds[0],y+piggy_mesh->Bounds[1],x+piggy_mesh->Bounds[2],y+piggy_mesh->Bounds[3]))
         {
-            for (int i1 = 0; i1 < 360;i1+=60)
-                drawobject(piggy_ear,glm::vec3(piggy_pos[i][0]-24,piggy_pos[i][1]+15,0),i1,glm::vec3(0,0,1));            
-            for (int i1 = 0; i1 < 360;i1+=60)
-                drawobject(piggy_ear,glm::vec3(piggy_pos[i][0]+24,piggy_pos[i][1]+15,0),i1,glm::vec3(0,0,1));            
-            for (int i1 = 0; i1 < 360;i1+=60)
-                drawobject(piggy_head,glm::vec3(piggy_pos[i][0],piggy_pos[i][1],0),i1,glm::vec3(0,0,1));
-            if (piggy_pos[i][2]>=1)
-                for (int i1 = 0; i1 < 360;i1+=60)
-                    drawobject(piggy_big_eye,glm::vec3(piggy_pos[i][0]-12,piggy_pos[i][1]+12,0),i1,glm::vec3(0,0,1));            
-            if (piggy_pos[i][2]>1)
-                for (int i1 = 0; i1 < 360;i1+=60)
-                    drawobject(piggy_big_eye,glm::vec3(piggy_pos[i][0]+12,piggy_pos[i][1]+12,0),i1,glm::vec3(0,0,1));            
-            for (int i1 = 0; i1 < 360;i1+=60)
-                drawobject(piggy_eye,glm::vec3(piggy_pos[i][0]+12,piggy_pos[i][1]+12,0),i1,glm::vec3(0,0,1));
-            for (int i1 = 0; i1 < 360;i1+=60)
-                drawobject(piggy_eye,glm::vec3(piggy_pos[i][0]-12,piggy_pos[i][1]+12,0),i1,glm::vec3(0,0,1));
-            for (int i1 = 0; i1 < 360;i1+=60)
-                drawobject(piggy_big_nose,glm::vec3(piggy_pos[i][0],piggy_pos[i][1]-8,0),i1,glm::vec3(0,0,1));
-            for (int i1 = 0; i1 < 360;i1+=60)
-                drawobject(piggy_small_nose,glm::vec3(piggy_pos[i][0]-4,piggy_pos[i][1]-8,0),i1,glm::vec3(0,0,1));
-            for (int i1 = 0; i1 < 360;i1+=60)
-                drawobject(piggy_small_nose,glm::vec3(piggy_pos[i][0]+4,piggy_pos[i][1]-8,0),i1,glm::vec3(0,0,1));            
+            CompositeInstance piggy;
+            piggy.Translate[0]=piggy_pos[i][0];
+            piggy.Translate[1]=piggy_pos[i][1];
+            piggy.Damage=piggy_pos[i][2];
+            piggy_instances.push_back(piggy);
         }
     }
     for (int i = 0; i < no_of_coins;i++)
         if (coins[i][3]==1)
-            for (int i1 = 0; i1 < 360; ++i1)
-                drawobject(coins_objects[i],glm::vec3(coins[i][0],coins[i][1],0),i1,glm::vec3(0,0,1));
-    for (int i = 0; i < no_of_fixed_objects; ++i)
-        drawobject(fixed_object[i],glm::vec3(fixe[i][0],fixe[i][1],0),0,glm::vec3(0,0,1));
+            addShape(coins[i][0],coins[i][1],coins[i][2],0,coin_color);
     for (int i = 0; i < no_of_objects;i++)
     {
         if (objects[i][13]==1)
@@ -1304,8 +3793,7 @@ void draw()
         if (objects[i][16]<=no_of_collisions_allowed)
         {
             if (objects[i][4]==0)
-                for (int j = 0; j < 360; ++j)
-                    drawobject(objects_def[i],glm::vec3(int(objects[i][0]),int(objects[i][1]),0),j,glm::vec3(0,0,1));
+                addInstance(disc_instances,int(objects[i][0]),int(objects[i][1]),objects[i][5],object_color);
             else
                 drawobject(objects_def[i],glm::vec3(objects[i][0],objects[i][1],0),0,glm::vec3(0,0,1));
         }
@@ -1332,8 +3820,7 @@ void draw()
             canon_x_direction=-1;
         else
             canon_x_direction=1;
-        for (int i = 0; i < 360; ++i)
-            drawobject(circle1,glm::vec3(canon_x_position,canon_y_position,0),i,glm::vec3(0,0,1));
+        addShape(canon_x_position,canon_y_position,radius_of_canon,0,coin_color);
         canon_y_position=canon_y_initial_position+((canon_velocity*sin(canon_theta))*tim - (gravity*tim*tim)/2)*10;
         canon_x_position=canon_x_initial_position+((canon_velocity*cos(canon_theta))*tim)*10;
         if (canon_x_velocity<=1 && canon_x_velocity>=-1 && canon_y_velocity<=1 && canon_y_velocity>=-1)
@@ -1347,75 +3834,105 @@ void draw()
         canon_x_velocity=70;
         //set_canon_position(canon_x_position,canon_y_position,canon_y_velocity,canon_x_velocity,0,0,canon_x_velocity,canon_y_velocity);
     }
-    int score1=score,var_s;
-    double x_cor=width-width/10,y_cor=height-height/40;
-    while(score1!=0)
-    {
-        var_s=score1%10;
-        if (a[var_s][0]==1)
-            drawobject(score_hor,glm::vec3(x_cor,y_cor,0),0,glm::vec3(0,0,1));
-        if (a[var_s][1]==1)
-            drawobject(score_ver,glm::vec3(x_cor+15,y_cor-15,0),0,glm::vec3(0,0,1));
-        if (a[var_s][2]==1)
-            drawobject(score_ver,glm::vec3(x_cor+15,y_cor-30,0),0,glm::vec3(0,0,1));
-        if (a[var_s][3]==1)
-            drawobject(score_hor,glm::vec3(x_cor,y_cor-30,0),0,glm::vec3(0,0,1));
-        if (a[var_s][4]==1)
-            drawobject(score_ver,glm::vec3(x_cor,y_cor-30,0),0,glm::vec3(0,0,1));
-        if (a[var_s][5]==1)
-            drawobject(score_ver,glm::vec3(x_cor,y_cor-15,0),0,glm::vec3(0,0,1));
-        if (a[var_s][6]==1)
-            drawobject(score_hor,glm::vec3(x_cor,y_cor-15,0),0,glm::vec3(0,0,1));
-        score1/=10;
-        x_cor-=25;
-    }
-    glm::vec3 fontColor = glm::vec3(0,0,0);
-	glUseProgram(fontProgramID);
-	Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
-	glm::mat4 MVP;
-	// Transform the text
-	Matrices.model = glm::mat4(1.0f);
-	glm::mat4 translateText = glm::translate(glm::vec3(width*8/11,height*16/17,0));
-	glm::mat4 scaleText = glm::scale(glm::vec3(50,50,50));
-	Matrices.model *= (translateText * scaleText);
-	MVP = Matrices.projection * Matrices.view * Matrices.model;
-	// send font's MVP and font color to fond shaders
-	glUniformMatrix4fv(GL3Font.fontMatrixID, 1, GL_FALSE, &MVP[0][0]);
-	glUniform3fv(GL3Font.fontColorID, 1, &fontColor[0]);
+    // One draw call per round mesh type for everything in the world
+    drawInstances(round_half_disc,half_disc_instances,LAYER_PROPS);
+    drawInstances(round_disc,disc_instances,LAYER_WORLD);
+    drawComposites(piggy_mesh,piggy_instances,LAYER_WORLD);
+    drawShapes(LAYER_WORLD);
+
+    // Everything is queued - render the frame with the final camera
+    updateCamera();
+    glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (createBackdrops())
+        StaticLayer.Valid=false;
+    drawStaticLayer();
+    drawHudLayer();
+    executeRenderQueue(FrameQueue);
+}
 
-	// Render font
-	GL3Font.font->Render("SCORE:");
+/* Delete every GL object while the context is still current - global handles are empty afterwards */
+void releaseGLResources()
+{
+    releaseShaderWatch();
+    releaseTextureLoader();
+    programID.reset();
+    fontProgramID.reset();
+    textureProgramID.reset();
+    instancedProgramID.reset();
+    shapeProgramID.reset();
+    compositeProgramID.reset();
+    quadProgramID.reset();
+    segmentProgramID.reset();
+    beach_texture.reset();
+    releaseTextureAtlas();
+    Matrices.CameraBuffer.reset();
+
+    releaseLayerCache(StaticLayer);
+    releaseLayerCache(HudLayer);
+
+    Batch.VertexArrayID.reset();
+    releaseStreamBuffer();
+
+    Geometry.ColorVAO.reset();
+    Geometry.FlatVAO.reset();
+    Geometry.TexturedVAO.reset();
+    Geometry.InstancedVAO.reset();
+    Geometry.ShapeVAO.reset();
+    Geometry.CompositeVAO.reset();
+    Geometry.QuadVAO.reset();
+    Geometry.Color.VertexBuffer.reset();
+    Geometry.Flat.VertexBuffer.reset();
+    Geometry.Textured.VertexBuffer.reset();
+    Geometry.Composite.VertexBuffer.reset();
+
+    Font.Texture.reset();
+    Geometry.TextVAO.reset();
+    Geometry.DigitVAO.reset();
 }
 
 /* Initialize the OpenGL rendering properties */
 /* Add all the models to be created here */
 void initGL (GLFWwindow* window, int width, int height)
 {
-	// Load Textures
-	// Enable Texture0 as current texture memory
-	glActiveTexture(GL_TEXTURE0);
-	// load an image file directly as a new OpenGL texture
-	// GLuint texID = SOIL_load_OGL_texture ("beach.png", SOIL_LOAD_AUTO, SOIL_CREATE_NEW_ID, SOIL_FLAG_TEXTURE_REPEATS); // Buggy for OpenGL3
-	GLuint textureID = createTexture("beach2.png");
-	// check for an error during the load process
-	if(textureID == 0 )
-		cout << "SOIL loading error: '" << SOIL_last_result() << "'" << endl;
+	// Nothing is known about the context's bindings yet
+	glsInvalidate();
 
-	// Create and compile our GLSL program from the texture shaders
-	textureProgramID = LoadShaders( "TextureRender.vert", "TextureRender.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.TexMatrixID = glGetUniformLocation(textureProgramID, "MVP");
+	// Start compiling every program now, the driver works on them while the rest is set up
+	beginShaderPrograms(ShaderPrograms, NUM_SHADER_PROGRAMS);
 
+	// Per frame vertex and instance data - 1 MB per segment
+	initStreamBuffer(1 << 20);
+	// Every mesh lives in a geometry pool, so these must exist before any object is created
+	initGeometryPools();
+	initCamera();
 
-	/* Objects should be created before any other gl function and shaders */
-	// Create the models
+	// Load Textures
+	// Enable Texture0 as current texture memory
+	glActiveTexture(GL_TEXTURE0);
+	// Images are decoded in the background - textures show a placeholder until pollTextureLoads uploads them
+	initTextureLoader();
+	beach_texture.reset(createTexture("beach2.png"));
+	// Backdrop images share one atlas page - createBackdrops builds their meshes once they are packed
+	queueAtlasImages(backdrop_images, no_of_backdrops);
 
+	// Rasterize the font once - all text is drawn from the glyph atlas
+	const char* fontfile = "arial.ttf";
+	if (!createGlyphAtlas(fontfile, 48))
+	{
+		cout << "Error: Could not load font `" << fontfile << "'" << endl;
+		releaseGLResources(); // Joins the texture workers, exit must not find them running
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
 
-	// Create and compile our GLSL program from the shaders
-	programID = LoadShaders( "Sample_GL3.vert", "Sample_GL3.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	// Only now wait for the compiler
+	finishShaderPrograms(ShaderPrograms, NUM_SHADER_PROGRAMS);
+	configureShaderPrograms();
+	initShaderWatch();
 
+	initSpriteBatch();
+	initLayerCache(StaticLayer,false);
+	initLayerCache(HudLayer,true);
 
 	reshapeWindow (window, width, height);
 
@@ -1423,38 +3940,12 @@ void initGL (GLFWwindow* window, int width, int height)
 	glClearColor (0.701,1,0.898, 0.0f); // R, G, B, A
 	glClearDepth (1.0f);
 
-	glEnable (GL_DEPTH_TEST);
+	// Draw order comes from the render queue layers, not the depth buffer
+	glDisable (GL_DEPTH_TEST);
 	glDepthFunc (GL_LEQUAL);
 	//glEnable(GL_BLEND);
 	//glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	// Initialise FTGL stuff
-	const char* fontfile = "arial.ttf";
-	GL3Font.font = new FTExtrudeFont(fontfile); // 3D extrude style rendering
-
-	if(GL3Font.font->Error())
-	{
-		cout << "Error: Could not load font `" << fontfile << "'" << endl;
-		glfwTerminate();
-		exit(EXIT_FAILURE);
-	}
-
-	// Create and compile our GLSL program from the font shaders
-	fontProgramID = LoadShaders( "fontrender.vert", "fontrender.frag" );
-	GLint fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform;
-	fontVertexCoordAttrib = glGetAttribLocation(fontProgramID, "vertexPosition");
-	fontVertexNormalAttrib = glGetAttribLocation(fontProgramID, "vertexNormal");
-	fontVertexOffsetUniform = glGetUniformLocation(fontProgramID, "pen");
-	GL3Font.fontMatrixID = glGetUniformLocation(fontProgramID, "MVP");
-	GL3Font.fontColorID = glGetUniformLocation(fontProgramID, "fontColor");
-
-	GL3Font.font->ShaderLocations(fontVertexCoordAttrib, fontVertexNormalAttrib, fontVertexOffsetUniform);
-	GL3Font.font->FaceSize(1);
-	GL3Font.font->Depth(0);
-	GL3Font.font->Outset(0, 0);
-	GL3Font.font->CharMap(ft_encoding_unicode);
-
-	intialize_a();
     background();
     double clr[6][3];
     for (int i = 0; i < 6; ++i)
@@ -1465,10 +3956,19 @@ void initGL (GLFWwindow* window, int width, int height)
         }
         clr[i][0]=1;
     }
+    for (int l = 0; l < ROUND_LODS; l++)
+    {
+        round_disc.Levels[l]=createDisc(1,round_segments[l],clr);
+        round_half_disc.Levels[l]=createDisc(1,round_segments[l]/2,clr,0,180);
+    }
+    unit_disc=round_disc.Levels[ROUND_LODS-1];
+    unit_half_disc=round_half_disc.Levels[ROUND_LODS-1];
+    const GLfloat quad_buffer_data[]={-1,-1,0, 1,-1,0, -1,1,0, 1,1,0};
+    shape_quad=create3DObject(GL_TRIANGLE_STRIP,4,quad_buffer_data,1,1,1);
     for (int i = 0; i < no_of_objects; i++)
     {
         if (objects[i][4]==0)
-            objects_def[i]=createSector(objects[i][5],360,clr);
+            objects_def[i]=unit_disc;
         else if (objects[i][4]==1)
             objects_def[i]=createRectangle(objects[i][6],objects[i][7],clr);
     }
@@ -1487,69 +3987,20 @@ void initGL (GLFWwindow* window, int width, int height)
         clr[i][2]=0.2;
     }
     for (int i = 0; i < no_of_coins; ++i)
-        coins_objects[i]=createSector(coins[i][2],360,clr);
+        coins_objects[i]=unit_disc;
     //programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-    circle1=createSector(10,360,clr);
-    circle2=createSector(30,360,clr);
+    circle1=unit_disc;
+    circle2=unit_disc;
     for (int i = 0; i < 6; ++i)
     {
         clr[i][0]=1;
         clr[i][1]=1;
         clr[i][2]=1;
     }
-    cloud=createSector(30,60,clr);
-    half_circle = createSector(40,360,clr);
+    cloud=unit_half_disc;
+    half_circle=unit_half_disc;
     rectangle = createRectangle(100,20,clr);
-    for (int i = 0; i < 6; ++i)
-    {
-        clr[i][0]=1.0;
-        clr[i][1]=0.4;
-        clr[i][2]=0.6;
-    }
-    piggy_head=createSector(radius_of_piggy,6,clr);
-    for (int i = 0; i < 6; ++i)
-    {
-        clr[i][0]=1;
-        clr[i][1]=1;
-        clr[i][2]=1;
-    }
-    piggy_eye=createSector(5,6,clr);
-    for (int i = 0; i < 6; ++i)
-    {
-        clr[i][0]=0;
-        clr[i][1]=0;
-        clr[i][2]=0;
-    }
-    piggy_big_eye=createSector(7,6,clr);
-    for (int i = 0; i < 6; ++i)
-    {
-        clr[i][0]=0;
-        clr[i][1]=0;
-        clr[i][2]=0;
-    }
-    piggy_big_nose=createSector(10,6,clr);
-	for (int i = 0; i < 6; ++i)
-    {
-        clr[i][0]=1;
-        clr[i][1]=1;
-        clr[i][2]=1;
-    }
-    piggy_small_nose=createSector(3,6,clr);
-    for (int i = 0; i < 6; ++i)
-    {
-        clr[i][0]=1;
-        clr[i][1]=0;
-        clr[i][2]=0.33;
-    }
-    piggy_ear=createSector(8,6,clr);
-    for (int i = 0; i < 6; ++i)
-    {
-        clr[i][0]=1;
-        clr[i][1]=0;
-        clr[i][2]=0;
-    }
-    score_ver=createRectangle(4,18,clr);
-    score_hor=createRectangle(18,4,clr);
+    piggy_mesh=createPiggy();
 
 	cout << "VENDOR: " << glGetString(GL_VENDOR) << endl;
 	cout << "RENDERER: " << glGetString(GL_RENDERER) << endl;
@@ -1569,6 +4020,8 @@ int main (int argc, char** argv)
     while (!glfwWindowShouldClose(window)) 
     {
         glfwGetCursorPos(window,&xmousePos,&ymousePos);
+        pollShaderWatch(); // Relinks edited shaders without a restart
+        pollTextureLoads(); // Uploads images the workers finished decoding
         draw();
         checkcollision();
         glfwSwapBuffers(window);
@@ -1578,6 +4031,11 @@ int main (int argc, char** argv)
         current_time = glfwGetTime(); // Time in seconds
         if ((current_time - last_update_time) >= 0.4) { // atleast 0.5s elapsed since last frame
             last_update_time = current_time;
+            if (show_render_stats)
+            {
+                cout << "GL calls per frame: " << GLState.LastIssued << " issued, " << GLState.LastElided << " elided\n";
+                cout << "Renderables per frame: " << Cull.LastDrawn << " drawn, " << Cull.LastCulled << " culled\n";
+            }
         }
         no_of_piggy_hit=0;
         for (int i = 0; i < no_of_piggy; ++i)
@@ -1586,6 +4044,7 @@ int main (int argc, char** argv)
         if (no_of_piggy_hit==no_of_piggy)
             quit(window);
     }
+    releaseGLResources();
     glfwTerminate();
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
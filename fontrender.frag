@@ -1,14 +1,21 @@
 #version 330 core
 
 // Interpolated values from the vertex shaders
+in vec2 fragTexCoord;
 in vec3 fragColor;
 
+// Glyph coverage, one channel
+uniform sampler2D glyphAtlas;
+
 // output data
-out vec3 color;
+out vec4 color;
 
 void main()
 {
-    // Output color = color specified in the vertex shader,
-    // interpolated between all 3 surrounding vertices of the triangle
-    color = fragColor;
-}
\ No newline at end of file
+    // Coverage of the glyph becomes the alpha of the text color
+    float coverage = texture(glyphAtlas, fragTexCoord).r;
+    if (coverage <= 0.0)
+        discard;
+
+    color = vec4(fragColor, coverage);
+}